@@ -0,0 +1,48 @@
+/* "run_batch" runs one prepared program for many inputs in parallel. Each
+ * input gets its own interpreter, all of them share the same bytecode (and
+ * native code). Results are returned in the order of the inputs.
+ */
+
+#pragma once
+
+#include "interpreter.h"
+#include "prepared_program.h"
+#include "thread_pool.h"
+
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace bf {
+
+template <typename memory_type>
+struct batch_result {
+    run_status               status;
+    std::vector<memory_type> output;
+    std::exception_ptr       error; // Set, if the run threw an exception
+};
+
+template <typename memory_type = unsigned char, typename tape_type = vector_tape<memory_type>>
+std::vector<batch_result<memory_type>> run_batch(thread_pool &pool,
+        const std::shared_ptr<const prepared_program> &program,
+        const std::vector<std::vector<memory_type>> &inputs,
+        engine e = engine::switch_dispatch, const run_limits &limits = run_limits())
+{
+    if (e == engine::jit && interpreter<memory_type, tape_type>::supports(e))
+        program->jit(); // Compile once up front
+
+    std::vector<batch_result<memory_type>> results(inputs.size());
+    pool.parallel_for(inputs.size(), [&](std::size_t i) {
+        try {
+            interpreter<memory_type, tape_type> bfi(program, e);
+            bfi.send_input(inputs[i]);
+            results[i].status = bfi.run(limits);
+            results[i].output = bfi.recv_output();
+        } catch (...) {
+            results[i].error = std::current_exception();
+        }
+    });
+    return results;
+}
+
+} // namespace bf
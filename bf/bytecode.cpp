@@ -0,0 +1,579 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+namespace bf {
+
+// Bytecode under construction with source position of each instruction
+struct lowering {
+    bytecode   code;
+    source_map positions;
+
+    void push(const operation &o, std::size_t position) {
+        code.push_back(o);
+        positions.push_back(static_cast<std::uint32_t>(position));
+    }
+
+    void resize(std::size_t size) {
+        code.resize(size);
+        positions.resize(size);
+    }
+};
+
+// Reduce 'value' modulo 2^bits to [-2^(bits-1), 2^(bits-1)).
+static std::int32_t wrap(std::int64_t value, unsigned bits) {
+    if (bits >= 32)
+        return static_cast<std::int32_t>(static_cast<std::uint32_t>(value));
+    const std::int64_t range = std::int64_t(1) << bits;
+    value = (value % range + range) % range;
+    return static_cast<std::int32_t>(value >= range / 2 ? value - range : value);
+}
+
+// Add 'delta' to the cell at 'offset'. Adds to different cells commute, so the
+// delta is merged into an add to the same cell among the trailing adds. With
+// wrapping cells, adds folded to zero are dropped again. Else, only adds of the
+// same sign are merged, as e.g. "+-" is no no-op for a saturated cell.
+static void fold_add(lowering &l, std::int32_t offset, std::int32_t delta, std::size_t position,
+                     const cell_type &cells) {
+    bytecode &code = l.code;
+    for (std::size_t i = code.size(); i-- > 0 && code[i].op == opcode::add;) {
+        if (code[i].offset != offset)
+            continue;
+        if (cells.mode == overflow::wrap) {
+            code[i].value = wrap(static_cast<std::int64_t>(code[i].value) + delta, cells.bits);
+            if (code[i].value == 0) {
+                code.erase(code.begin() + i);
+                l.positions.erase(l.positions.begin() + i);
+            }
+            return;
+        }
+        if ((code[i].value > 0) == (delta > 0)) {
+            code[i].value += delta;
+            return;
+        }
+        break;
+    }
+    l.push({opcode::add, offset, delta, 0}, position);
+}
+
+// Emit the virtual move of the stack pointer accumulated in 'pending', which
+// started at source position 'position'.
+static void flush_move(lowering &l, std::int32_t &pending, std::size_t position) {
+    if (pending != 0)
+        l.push({opcode::move, 0, pending, 0}, position);
+    pending = 0;
+}
+
+// Value of a cell after one loop iteration as affine function of the cell
+// values before it: constant + sum of factor * cell.
+struct affine {
+    std::int64_t                         constant = 0;
+    std::map<std::int32_t, std::int64_t> factors; // Offset of cell to factor
+
+    static affine cell(std::int32_t offset) {
+        affine result;
+        result.factors[offset] = 1;
+        return result;
+    }
+
+    bool is_constant() const {return factors.empty();}
+
+    // Add 'factor' times 'other', reduced modulo the cell width.
+    void add(const affine &other, std::int64_t factor, unsigned bits) {
+        constant = wrap(constant + factor * other.constant, bits);
+        for (const auto &f : other.factors) {
+            const std::int64_t sum = wrap(factors[f.first] + factor * f.second, bits);
+            if (sum == 0)
+                factors.erase(f.first);
+            else
+                factors[f.first] = sum;
+        }
+    }
+};
+
+// Replace the loop starting at 'begin' by its closed form. The body is
+// executed symbolically, which requires it to consist of 'add', 'move' and
+// already folded loops only. The loop has a closed form, if the body does not
+// move the stack pointer in total and decrements (or increments) the current
+// cell by exactly 1, so the number of iterations is given by the value of the
+// current cell. Every other cell must then either stay unchanged (invariant),
+// get the same affine function of invariant cells added in each iteration or
+// be set to the same constant in each iteration.
+static bool fold_affine_loop(lowering &l, std::size_t begin, const cell_type &cells) {
+    const bytecode &code = l.code;
+    const unsigned bits = cells.bits;
+    std::map<std::int32_t, affine> values; // Changed cells
+    const auto value = [&values](std::int32_t offset) {
+        const auto it = values.find(offset);
+        return it != values.end() ? it->second : affine::cell(offset);
+    };
+
+    std::int32_t offset = 0;
+    for (std::size_t i = begin + 1; i < code.size(); ++i) {
+        const operation &o = code[i];
+        switch (o.op) {
+        case opcode::add: {
+            affine target = value(offset + o.offset);
+            target.constant = wrap(target.constant + o.value, bits);
+            values[offset + o.offset] = target;
+            break;
+            }
+        case opcode::move:
+            offset += o.value;
+            break;
+        case opcode::clear:
+            values[offset + o.offset] = affine();
+            break;
+        case opcode::multiply_add: {
+            affine target = value(offset + o.offset);
+            target.add(value(offset), o.value, bits);
+            values[offset + o.offset] = target;
+            break;
+            }
+        case opcode::product_add: {
+            // Only affine, if one of both factors is constant.
+            const affine a = value(offset), b = value(offset + o.source());
+            if (!a.is_constant() && !b.is_constant())
+                return false;
+            affine target = value(offset + o.offset);
+            if (a.is_constant())
+                target.add(b, wrap(o.value * a.constant, bits), bits);
+            else
+                target.add(a, wrap(o.value * b.constant, bits), bits);
+            values[offset + o.offset] = target;
+            break;
+            }
+        case opcode::conditional_set: {
+            const affine condition = value(offset);
+            if (!condition.is_constant())
+                return false;
+            if (condition.constant != 0) {
+                values[offset + o.offset] = affine();
+                values[offset + o.offset].constant = wrap(o.value, bits);
+            }
+            break;
+            }
+        default:
+            return false;
+        }
+    }
+    if (offset != 0)
+        return false;
+
+    // The control cell counts towards 0.
+    const affine control = value(0);
+    if (control.factors.size() != 1 || control.factors.count(0) != 1 || control.factors.at(0) != 1
+            || (control.constant != 1 && control.constant != -1))
+        return false;
+    const auto invariant = [&values](std::int32_t offset) {
+        const auto it = values.find(offset);
+        return it == values.end() || (it->second.constant == 0 && it->second.factors.size() == 1
+                                      && it->second.factors.count(offset) == 1
+                                      && it->second.factors.at(offset) == 1);
+    };
+
+    // Emit closed form, reading the control cell and invariant cells only.
+    // With an incrementing control cell, the loop runs (0 - value) times.
+    std::vector<operation> closed_form;
+    const std::int64_t direction = -control.constant;
+    for (const auto &v : values) {
+        const std::int32_t cell = v.first;
+        affine delta = v.second;
+        if (cell == 0 || invariant(cell))
+            continue;
+
+        if (delta.factors.count(cell) == 0) {
+            // Set to the same constant in each iteration
+            if (!delta.is_constant())
+                return false;
+            closed_form.push_back({opcode::conditional_set, cell, static_cast<std::int32_t>(delta.constant), 0});
+            continue;
+        }
+
+        // Adds the same value in each iteration
+        delta.add(affine::cell(cell), -1, bits);
+        if (delta.factors.count(cell) != 0)
+            return false;
+        if (delta.constant != 0)
+            closed_form.push_back({opcode::multiply_add, cell, wrap(direction * delta.constant, bits), 0});
+        for (const auto &f : delta.factors) {
+            if (f.first == 0 || !invariant(f.first))
+                return false;
+            closed_form.push_back({opcode::product_add, cell, wrap(direction * f.second, bits),
+                                   static_cast<std::uint32_t>(f.first)});
+        }
+    }
+    closed_form.push_back({opcode::clear, 0, 0, 0});
+
+    const std::size_t position = l.positions[begin]; // Of '['
+    l.resize(begin);
+    for (const auto &o : closed_form)
+        l.push(o, position);
+    return true;
+}
+
+// Replace the loop starting at 'begin' by 'multiply_add' and 'clear' for
+// saturating, trapping or 64 bit cells. Like a closed form, but the body may
+// only consist of 'add' and 'move' with at most one add per cell and the
+// control cell must be unsigned and decrementing. So the loop adds the same
+// constant in each single step and always terminates.
+static bool fold_counted_loop(lowering &l, std::size_t begin, const cell_type &cells) {
+    const bytecode &code = l.code;
+    std::map<std::int32_t, std::int32_t> deltas; // Offset to value
+    std::int32_t offset = 0;
+    for (std::size_t i = begin + 1; i < code.size(); ++i) {
+        if (code[i].op == opcode::add) {
+            if (!deltas.emplace(offset + code[i].offset, code[i].value).second)
+                return false;
+        } else if (code[i].op == opcode::move)
+            offset += code[i].value;
+        else
+            return false;
+    }
+    if (offset != 0 || cells.is_signed || deltas[0] != -1)
+        return false;
+
+    const std::size_t position = l.positions[begin]; // Of '['
+    l.resize(begin);
+    for (const auto &delta : deltas) {
+        if (delta.first != 0)
+            l.push({opcode::multiply_add, delta.first, delta.second, 0}, position);
+    }
+    l.push({opcode::clear, 0, 0, 0}, position);
+    return true;
+}
+
+// Replace the loop starting at 'begin' by 'scan', if its body only moves the
+// stack pointer. Else, replace it by its closed form, if there is one.
+static bool fold_loop(lowering &l, std::size_t begin, const cell_type &cells) {
+    const bytecode &code = l.code;
+    if (code.size() == begin + 2 && code.back().op == opcode::move) {
+        const std::size_t position = l.positions[begin]; // Of '['
+        const std::int32_t stride = code.back().value;
+        l.resize(begin);
+        l.push({opcode::scan, 0, stride, 0}, position);
+        return true;
+    }
+    // Factors of wider cells may not fit into an operation.
+    if (cells.mode == overflow::wrap && cells.bits <= 32)
+        return fold_affine_loop(l, begin, cells);
+    return fold_counted_loop(l, begin, cells);
+}
+
+bytecode lower(const std::string &program, source_map *positions, const cell_type &cells) {
+    if (program.size() > std::numeric_limits<std::uint32_t>::max())
+        throw std::logic_error("Program too large!");
+
+    lowering l;
+    std::vector<std::size_t> loop_stack; // Source and bytecode position of '['
+    std::int32_t pending = 0;            // Virtual move of the stack pointer
+    std::size_t pending_position = 0;    // Source position of first '>' or '<' of it
+
+    for (std::size_t pos = 0; pos < program.size(); ++pos) {
+        switch (program[pos]) {
+        case '>':
+        case '<': if (pending == 0)
+                      pending_position = pos;
+                  pending += program[pos] == '>' ? 1 : -1;
+                  break;
+        case '+': fold_add(l, pending, 1, pos, cells);
+                  break;
+        case '-': fold_add(l, pending, -1, pos, cells);
+                  break;
+        case '.': l.push({opcode::write, pending, 0, 0}, pos);
+                  break;
+        case ',': l.push({opcode::read, pending, 0, 0}, pos);
+                  break;
+        case '[': flush_move(l, pending, pending_position);
+                  loop_stack.push_back(pos);
+                  loop_stack.push_back(l.code.size());
+                  l.push({opcode::jump_zero, 0, 0, 0}, pos);
+                  break;
+        case ']': {
+                  if (loop_stack.empty())
+                      throw std::logic_error("Unmatched ']' at position " + std::to_string(pos) + "!");
+                  flush_move(l, pending, pending_position);
+                  const std::size_t begin = loop_stack.back();
+                  loop_stack.resize(loop_stack.size() - 2);
+                  if (fold_loop(l, begin, cells))
+                      break;
+                  l.push({opcode::jump_not_zero, 0, 0, (std::uint32_t) begin + 1}, pos);
+                  l.code[begin].target = (std::uint32_t) l.code.size();
+                  break;
+                  }
+        default:  break; // No Brainfuck operation
+        }
+    }
+    flush_move(l, pending, pending_position);
+
+    if (!loop_stack.empty())
+        throw std::logic_error("Unmatched '[' at position "
+                               + std::to_string(loop_stack[loop_stack.size() - 2]) + "!");
+
+    if (positions)
+        positions->swap(l.positions);
+    return std::move(l.code);
+}
+
+// Concrete state of the program while evaluating its prefix. Cells are kept
+// wrapped like in 'lower'.
+struct prefix_state {
+    std::map<std::int64_t, std::int32_t> cells; // Position to value, 0 if missing
+    std::vector<std::int32_t>            output;
+    std::int64_t                         stack_pointer = 0;
+
+    std::int32_t &cell(std::int32_t offset) {return cells[stack_pointer + offset];}
+};
+
+// Run 'code' from its beginning until the instruction at 'stop' would be
+// executed or the next instruction depends on input (or would fail, e.g. by
+// accessing a cell below zero, or 'max_steps' are exceeded). Returns the
+// instruction it stopped at.
+static std::size_t run_prefix(const bytecode &code, std::size_t stop, std::uint64_t max_steps,
+                              const cell_type &cells, prefix_state &s) {
+    std::size_t ip = 0;
+    for (std::uint64_t step = 0; ip < code.size() && ip != stop && step < max_steps; ++step) {
+        const operation &o = code[ip];
+        const std::int32_t lowest = o.op == opcode::product_add ? std::min(o.offset, o.source()) : o.offset;
+        if (s.stack_pointer + lowest < 0)
+            return ip;
+        switch (o.op) {
+        case opcode::add:
+            s.cell(o.offset) = wrap(static_cast<std::int64_t>(s.cell(o.offset)) + o.value, cells.bits);
+            break;
+        case opcode::move:
+            if (s.stack_pointer + o.value < 0)
+                return ip;
+            s.stack_pointer += o.value;
+            break;
+        case opcode::read:
+            return ip;
+        case opcode::write:
+            s.output.push_back(s.cell(o.offset));
+            break;
+        case opcode::write_value:
+            s.output.push_back(o.value);
+            break;
+        case opcode::jump_zero:
+            if (s.cell(0) == 0) {
+                ip = o.target;
+                continue;
+            }
+            break;
+        case opcode::jump_not_zero:
+            if (s.cell(0) != 0) {
+                ip = o.target;
+                continue;
+            }
+            break;
+        case opcode::clear:
+            s.cell(o.offset) = 0;
+            break;
+        case opcode::multiply_add:
+            s.cell(o.offset) = wrap(s.cell(o.offset) + static_cast<std::int64_t>(s.cell(0)) * o.value, cells.bits);
+            break;
+        case opcode::scan: {
+            std::int64_t position = s.stack_pointer;
+            while (s.cells.count(position) != 0 && s.cells[position] != 0)
+                position += o.value;
+            if (position < 0)
+                return ip;
+            s.stack_pointer = position;
+            break;
+            }
+        case opcode::product_add: {
+            const std::int32_t factor = wrap(static_cast<std::int64_t>(s.cell(0)) * s.cell(o.source()), cells.bits);
+            s.cell(o.offset) = wrap(s.cell(o.offset) + static_cast<std::int64_t>(factor) * o.value, cells.bits);
+            break;
+            }
+        case opcode::conditional_set:
+            if (s.cell(0) != 0)
+                s.cell(o.offset) = o.value;
+            break;
+        }
+        ++ip;
+    }
+    return ip;
+}
+
+bytecode evaluate_prefix(const bytecode &code, source_map *positions, const cell_type &cells) {
+    static const std::uint64_t max_steps = 1 << 20;
+    if (cells.mode != overflow::wrap || cells.bits > 32)
+        return code;
+
+    // Execution can only be continued at an instruction outside of loops, so
+    // the prefix ends in front of the outermost loop around the stop.
+    prefix_state s;
+    const std::size_t stop = run_prefix(code, code.size(), max_steps, cells, s);
+    std::size_t cut = 0, depth = 0;
+    for (std::size_t ip = 0; ip < stop; ++ip) {
+        if (depth == 0)
+            cut = ip;
+        if (code[ip].op == opcode::jump_zero)
+            ++depth;
+        else if (code[ip].op == opcode::jump_not_zero)
+            --depth;
+    }
+    if (depth == 0)
+        cut = stop;
+    if (cut == 0)
+        return code;
+
+    // Top level instructions are executed exactly once, so the state in front
+    // of 'cut' is reached by running again.
+    s = prefix_state();
+    run_prefix(code, cut, max_steps, cells, s);
+
+    lowering l;
+    const std::uint32_t position = positions && !positions->empty() ? positions->front() : 0;
+    for (const std::int32_t value : s.output)
+        l.push({opcode::write_value, 0, value, 0}, position);
+    // Cells are initialized by adds with small offsets, moving in between.
+    static const std::int64_t max_distance = 64;
+    std::int64_t base = 0;
+    for (const auto &cell : s.cells) {
+        if (cell.second == 0)
+            continue;
+        if (cell.first - base > max_distance) {
+            if (cell.first - base > std::numeric_limits<std::int32_t>::max())
+                return code;
+            l.push({opcode::move, 0, static_cast<std::int32_t>(cell.first - base), 0}, position);
+            base = cell.first;
+        }
+        l.push({opcode::add, static_cast<std::int32_t>(cell.first - base), cell.second, 0}, position);
+    }
+    if (s.stack_pointer != base) {
+        if (s.stack_pointer - base > std::numeric_limits<std::int32_t>::max())
+            return code;
+        l.push({opcode::move, 0, static_cast<std::int32_t>(s.stack_pointer - base), 0}, position);
+    }
+
+    // Rest of the program with jump targets shifted
+    const std::size_t shift = l.code.size();
+    for (std::size_t ip = cut; ip < code.size(); ++ip) {
+        operation o = code[ip];
+        if (o.op == opcode::jump_zero || o.op == opcode::jump_not_zero)
+            o.target = static_cast<std::uint32_t>(o.target - cut + shift);
+        l.push(o, positions ? (*positions)[ip] : 0);
+    }
+
+    if (positions)
+        positions->swap(l.positions);
+    return std::move(l.code);
+}
+
+std::uint64_t hash(code_view code) {
+    std::uint64_t result = 14695981039346656037ull;
+    const auto add = [&result](std::uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            result ^= (value >> (8 * i)) & 0xff;
+            result *= 1099511628211ull;
+        }
+    };
+    for (const auto &o : code) {
+        add(static_cast<std::uint32_t>(o.op));
+        add(static_cast<std::uint32_t>(o.offset));
+        add(static_cast<std::uint32_t>(o.value));
+        add(o.target);
+    }
+    return result;
+}
+
+std::int32_t min_offset(code_view code) {
+    std::int32_t result = 0;
+    for (const auto &o : code) {
+        result = std::min(result, o.offset);
+        if (o.op == opcode::product_add)
+            result = std::min(result, o.source());
+    }
+    return result;
+}
+
+std::int32_t max_offset(code_view code) {
+    std::int32_t result = 0;
+    for (const auto &o : code) {
+        result = std::max(result, o.offset);
+        if (o.op == opcode::product_add)
+            result = std::max(result, o.source());
+    }
+    return result;
+}
+
+std::int64_t max_move(code_view code) {
+    std::int64_t result = 0, run = 0;
+    for (const auto &o : code) {
+        if (o.op == opcode::move)
+            run += std::abs(static_cast<std::int64_t>(o.value));
+        else if (o.op == opcode::scan)
+            run = std::abs(static_cast<std::int64_t>(o.value));
+        else if (o.op != opcode::write_value) // Writes no cell
+            run = 0;
+        result = std::max(result, run);
+    }
+    return result;
+}
+
+std::vector<std::int32_t> reach_offsets(code_view code) {
+    // Offsets only grow, so loops converge after a few passes.
+    std::vector<std::int32_t> result(code.size() + 1, 0);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (std::size_t ip = code.size(); ip-- > 0;) {
+            const operation &o = code[ip];
+            std::int32_t reach = 0;
+            switch (o.op) {
+            case opcode::move:
+            case opcode::scan:
+                break;
+            case opcode::jump_zero:
+            case opcode::jump_not_zero:
+                reach = std::max(result[ip + 1], result[o.target]);
+                break;
+            case opcode::write_value:
+                reach = result[ip + 1];
+                break;
+            case opcode::product_add:
+                reach = std::max({o.offset, o.source(), result[ip + 1]});
+                break;
+            default:
+                reach = std::max(o.offset, result[ip + 1]);
+                break;
+            }
+            if (reach > result[ip]) {
+                result[ip] = reach;
+                changed = true;
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<std::uint32_t> source_commands(const std::string &program, array_view<std::uint32_t> positions) {
+    // Instructions in order of their position, the first one of each position first
+    std::vector<std::size_t> order(positions.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&positions](std::size_t a, std::size_t b) {
+        return positions[a] < positions[b];
+    });
+
+    std::vector<std::uint32_t> result(positions.size(), 0);
+    for (std::size_t k = 0; k < order.size();) {
+        const std::size_t first = order[k];
+        while (k < order.size() && positions[order[k]] == positions[first])
+            ++k;
+        const std::size_t begin = first == order.front() ? 0 : positions[first];
+        const std::size_t end = k < order.size() ? positions[order[k]] : program.size();
+        for (std::size_t pos = begin; pos < end && pos < program.size(); ++pos)
+            result[first] += std::strchr("+-<>.,[]", program[pos]) != nullptr && program[pos] != '\0';
+    }
+    return result;
+}
+
+} // namespace bf
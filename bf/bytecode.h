@@ -0,0 +1,154 @@
+/* "bytecode" lowers Brainfuck source code to a compact instruction stream,
+ * which is executed by "interpreter". Runs of '+'/'-' and '>'/'<' are folded
+ * into single instructions and all non-Brainfuck characters are stripped.
+ * Within straight-line code, the stack pointer is only moved virtually: Cells
+ * are addressed by an offset instead and the accumulated move is only emitted
+ * at loop boundaries and at the end of the program (e.g. ">+<<-" becomes
+ * "add 1,1; add -1,-1; move -1").
+ * Simple loops, which only add constant multiples of the current cell to other
+ * cells (e.g. "[-]" or "[>+<-]"), are replaced by 'clear' and 'multiply_add'.
+ * Loops which only move the stack pointer (e.g. "[>]") are replaced by 'scan'.
+ * More generally, loops with a closed form are replaced by it: If the loop
+ * counts the current cell down (or up) to 0 and each iteration only adds the
+ * same affine function of cells it does not change (e.g. "[>[>+<<<+>>-]<-]"
+ * after folding the inner loop), 'product_add' and 'conditional_set' do all
+ * iterations at once. Loops are folded innermost first, so nested loops are
+ * solved bottom-up.
+ *
+ * Folding depends on the cells the program is lowered for: With wrapping cells,
+ * runs are reduced modulo the cell width (e.g. 256 '+' vanish for 8 bit cells).
+ * Saturating and trapping cells only allow folding where the result does not
+ * depend on the order of the single steps.
+ *
+ * Optionally, the prefix of the program which does not depend on input (e.g.
+ * printing a banner and initializing variables) is evaluated offline and
+ * replaced by its output and the resulting tape.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace bf {
+
+enum class opcode : unsigned char {
+    add,             // Add 'value' to cell at 'offset'
+    move,            // Move stack pointer by 'value'
+    read,            // Read input to cell at 'offset'
+    write,           // Write cell at 'offset' to output
+    jump_zero,       // Jump behind matching 'jump_not_zero' if current cell is 0
+    jump_not_zero,   // Jump behind matching 'jump_zero' if current cell is not 0
+    clear,           // Set cell at 'offset' to 0
+    multiply_add,    // Add current cell times 'value' to cell at 'offset'
+    scan,            // Move stack pointer by 'value' until current cell is 0
+    product_add,     // Add current cell times cell at 'source' times 'value' to cell at 'offset'
+    conditional_set, // Set cell at 'offset' to 'value' if current cell is not 0
+    write_value      // Write 'value' to output
+};
+
+const std::size_t opcode_count = static_cast<std::size_t>(opcode::write_value) + 1;
+
+// Jump targets are stored inline as absolute instruction indices, so no
+// lookup is needed when a loop is entered, skipped or repeated. 'product_add'
+// stores the offset of its source cell there instead.
+struct operation {
+    opcode        op;
+    std::int32_t  offset;
+    std::int32_t  value;
+    std::uint32_t target;
+
+    std::int32_t source() const {return static_cast<std::int32_t>(target);}
+};
+
+using bytecode = std::vector<operation>;
+
+// Read-only view of contiguous values, e.g. of bytecode in a mapped file
+template <typename value_type>
+class array_view {
+public:
+    array_view() : m_data(nullptr), m_size(0) {}
+    array_view(const value_type *data, std::size_t size) : m_data(data), m_size(size) {}
+    array_view(const std::vector<value_type> &values) : m_data(values.data()), m_size(values.size()) {}
+
+    const value_type *data() const {return m_data;}
+    std::size_t size() const {return m_size;}
+    bool empty() const {return m_size == 0;}
+    const value_type &operator[](std::size_t i) const {return m_data[i];}
+    const value_type *begin() const {return m_data;}
+    const value_type *end() const {return m_data + m_size;}
+
+private:
+    const value_type *m_data;
+    std::size_t      m_size;
+};
+
+using code_view = array_view<operation>;
+
+// Behaviour of a cell if a value does not fit
+enum class overflow : unsigned char {
+    wrap,      // Modulo 2^bits
+    saturate,  // Clamp to the range of the cell
+    trap      // Throw std::runtime_error
+};
+
+struct cell_type {
+    unsigned bits      = 8;
+    bool     is_signed = false;
+    overflow mode      = overflow::wrap;
+
+    template <typename memory_type>
+    static cell_type of(overflow mode = overflow::wrap) {
+        return {static_cast<unsigned>(8 * sizeof(memory_type)), std::is_signed<memory_type>::value, mode};
+    }
+
+    bool operator==(const cell_type &other) const {
+        return bits == other.bits && is_signed == other.is_signed && mode == other.mode;
+    }
+    bool operator!=(const cell_type &other) const {return !(*this == other);}
+};
+
+// Source position of each instruction. Instructions replacing a loop map to
+// its '['.
+using source_map = std::vector<std::uint32_t>;
+
+// Lower Brainfuck source code to bytecode for 'cells'. Throws std::logic_error
+// on unbalanced brackets. Source positions are stored to 'positions', if given.
+bytecode lower(const std::string &program, source_map *positions = nullptr,
+               const cell_type &cells = cell_type());
+
+// Partially evaluate 'code', which was lowered for 'cells': Its prefix up to
+// the first instruction depending on input is executed and replaced by its
+// net effect, i.e. 'write_value' for its output and adds initializing the
+// tape. Loops which are not left before are kept and execution of the prefix
+// is limited, so 'code' may also stay unchanged. Only wrapping cells of up to
+// 32 bits are supported. Source positions in 'positions' are updated, if given.
+bytecode evaluate_prefix(const bytecode &code, source_map *positions = nullptr,
+                         const cell_type &cells = cell_type());
+
+// Hash (FNV-1a) of 'code', e.g. to check if saved state belongs to a program.
+std::uint64_t hash(code_view code);
+
+// Lowest (at most 0) and highest (at least 0) cell offset used by 'code'.
+std::int32_t min_offset(code_view code);
+std::int32_t max_offset(code_view code);
+
+// Largest distance in cells the stack pointer is moved by 'code' without any
+// cell access in between: a single move or scan step, or a run of moves.
+std::int64_t max_move(code_view code);
+
+// Highest offset (at least 0) of a cell accessed from each instruction on,
+// following jumps, until the stack pointer is moved. The entry behind the last
+// instruction is 0. Jump targets must be valid.
+std::vector<std::int32_t> reach_offsets(code_view code);
+
+// Number of Brainfuck commands of 'program' each instruction stands for, given
+// the source position of each instruction. Commands between two positions are
+// counted for the first instruction at the lower one. So a folded loop counts
+// as often as its instructions are executed, not as often as it would repeat.
+std::vector<std::uint32_t> source_commands(const std::string &program, array_view<std::uint32_t> positions);
+
+} // namespace bf
@@ -0,0 +1,226 @@
+#include "c_backend.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+namespace bf {
+
+// Runtime support of the generated program. 'm' points to cell 0 of the tape,
+// 'c' to the current cell. Cells in reach of negative offsets are backed by
+// FRONT padding cells, cells in reach of positive offsets by BACK cells behind
+// 'reserved', so only moves of the current cell have to be checked.
+static const char *const c_prologue = R"(#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned char cell;
+
+static cell   *tape;
+static size_t size;
+static size_t reserved;
+
+static void fail(const char *message) {
+    fflush(stdout);
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+}
+
+/* Grow tape to make 'position' accessible, return new cell 0. New cells are
+   0, also the FRONT padding on first call. */
+static cell *grow(size_t position) {
+    const size_t old_end = size > 0 ? FRONT + size : 0;
+    size_t new_size = 2 * size > 4096 ? 2 * size : 4096;
+    if ((ptrdiff_t) position < 0)
+        fail("Stack pointer moved below zero!");
+    if (new_size < position + BACK + 1)
+        new_size = position + BACK + 1;
+    tape = realloc(tape, FRONT + new_size);
+    if (tape == NULL)
+        fail("Out of memory!");
+    memset(tape + old_end, 0, FRONT + new_size - old_end);
+    size = new_size;
+    reserved = size - BACK;
+    return tape + FRONT;
+}
+
+static cell read_cell(void) {
+    const int value = getchar();
+    if (value == EOF)
+        fail("Tried to read without data in input buffer!");
+    return (cell) value;
+}
+
+#define RESERVE()                           \
+    if ((size_t) (c - m) >= reserved) {     \
+        const size_t position = c - m;      \
+        m = grow(position);                 \
+        c = m + position;                   \
+    }
+
+int main(void) {
+    cell *m = grow(0);
+    cell *c = m;
+)";
+
+static const char *const c_epilogue = R"(
+    fflush(stdout);
+    return 0;
+}
+)";
+
+std::string emit_c(const bytecode &code) {
+    std::ostringstream out;
+    out << "/* Generated by bfc */\n";
+    out << "#define FRONT " << -min_offset(code) << '\n';
+    out << "#define BACK  " << max_offset(code) << '\n';
+    out << c_prologue;
+
+    std::string indent = "    ";
+    std::string text; // Pending 'write_value' output, written at once
+    const auto flush_text = [&] {
+        if (text.empty())
+            return;
+        out << indent << "fwrite(\"";
+        for (const char c : text) {
+            if (c == '"' || c == '\\' || c == '?' || c < ' ' || c > '~')
+                out << '\\' << std::oct << std::setw(3) << std::setfill('0')
+                    << static_cast<unsigned>(static_cast<unsigned char>(c)) << std::dec << std::setfill(' ');
+            else
+                out << c;
+        }
+        out << "\", 1, " << text.size() << ", stdout);\n";
+        text.clear();
+    };
+
+    for (const auto &o : code) {
+        if (o.op == opcode::write_value) {
+            text += static_cast<char>(o.value & 0xff);
+            continue;
+        }
+        flush_text();
+        switch (o.op) {
+        case opcode::add:
+            out << indent << "c[" << o.offset << "] += " << o.value << ";\n";
+            break;
+        case opcode::move:
+            out << indent << "c += " << o.value << "; RESERVE();\n";
+            break;
+        case opcode::read:
+            out << indent << "c[" << o.offset << "] = read_cell();\n";
+            break;
+        case opcode::write:
+            out << indent << "putchar(c[" << o.offset << "]);\n";
+            break;
+        case opcode::jump_zero:
+            out << indent << "while (c[0]) {\n";
+            indent += "    ";
+            break;
+        case opcode::jump_not_zero:
+            indent.resize(indent.size() - 4);
+            out << indent << "}\n";
+            break;
+        case opcode::clear:
+            out << indent << "c[" << o.offset << "] = 0;\n";
+            break;
+        case opcode::multiply_add:
+            // Reduce the factor to a byte to keep the product in range of int.
+            if ((o.value & 0xff) == 1)
+                out << indent << "c[" << o.offset << "] += c[0];\n";
+            else
+                out << indent << "c[" << o.offset << "] += c[0] * " << (o.value & 0xff) << ";\n";
+            break;
+        case opcode::product_add:
+            out << indent << "c[" << o.offset << "] += c[0] * c[" << o.source() << "]";
+            if ((o.value & 0xff) != 1)
+                out << " * " << (o.value & 0xff);
+            out << ";\n";
+            break;
+        case opcode::conditional_set:
+            out << indent << "if (c[0]) c[" << o.offset << "] = " << (o.value & 0xff) << ";\n";
+            break;
+        case opcode::scan:
+            // Scans are usually short, so a loop beats calling memchr.
+            out << indent << "while (c[0]) { c += " << o.value << "; RESERVE(); }\n";
+            break;
+        case opcode::write_value:
+            break; // Collected above
+        }
+    }
+    flush_text();
+
+    out << c_epilogue;
+    return out.str();
+}
+
+std::string emit_c(const std::string &program) {
+    return emit_c(evaluate_prefix(lower(program)));
+}
+
+// Run the program 'arguments[0]' (looked up in PATH) with all 'arguments'.
+// Returns whether it exited successfully.
+static bool run_program(const std::vector<std::string> &arguments) {
+#ifndef _WIN32
+    // No shell involved, so paths need no quoting.
+    std::vector<char*> argv;
+    for (const std::string &argument : arguments)
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+        return false;
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#else
+    // Quotes cannot be escaped for cmd.exe, so arguments containing one are
+    // rejected.
+    std::string command;
+    for (const std::string &argument : arguments) {
+        if (argument.find('"') != std::string::npos)
+            return false;
+        command += (command.empty() ? "\"" : " \"") + argument + '"';
+    }
+    return std::system(('"' + command + '"').c_str()) == 0;
+#endif
+}
+
+void compile_c(const std::string &c_source, const std::string &executable, const std::string &cc) {
+    std::vector<std::string> arguments;
+    std::istringstream words(cc);
+    for (std::string word; words >> word;)
+        arguments.push_back(word);
+    if (arguments.empty())
+        throw std::runtime_error("No C compiler given!");
+
+    const std::string source_file = executable + ".c";
+    {
+        std::ofstream out(source_file);
+        if (!(out << c_source))
+            throw std::runtime_error("Could not write " + source_file + "!");
+    }
+
+    arguments.insert(arguments.end(), {"-o", executable, source_file});
+    const bool success = run_program(arguments);
+    std::remove(source_file.c_str());
+    if (!success)
+        throw std::runtime_error("C compiler failed: " + cc + "!");
+}
+
+} // namespace bf
@@ -0,0 +1,32 @@
+/* "c_backend" translates Brainfuck source code to a standalone C program for
+ * ahead-of-time compilation by the system C compiler. The program is lowered
+ * to bytecode first, so folded runs and loop idioms end up in the C code.
+ *
+ * The generated program reads from stdin and writes to stdout. Just like
+ * "interpreter", cells are bytes with wrap around, the tape grows on demand
+ * and running out of input or moving below cell 0 is reported as an error.
+ */
+
+#pragma once
+
+#include "bytecode.h"
+
+#include <string>
+
+namespace bf {
+
+// Translate lowered bytecode to C source code.
+std::string emit_c(const bytecode &code);
+
+// Translate Brainfuck source code to C source code. The input independent
+// prefix of the program is evaluated at translation time (see
+// 'evaluate_prefix'). Throws std::logic_error on unbalanced brackets.
+std::string emit_c(const std::string &program);
+
+// Compile C source code to 'executable' by invoking 'cc', which may include
+// flags (e.g. "cc -O2" or "gcc -O3 -march=native"). It is split into words at
+// white space and run without a shell, so neither it nor the paths are
+// interpreted. Throws std::runtime_error if the compiler fails.
+void compile_c(const std::string &c_source, const std::string &executable, const std::string &cc = "cc -O2");
+
+} // namespace bf
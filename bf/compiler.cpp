@@ -45,16 +45,16 @@ program_t parse(const std::string &source) {
 // ----- Generate Brainfuck code from AST --------------------------------------
 compiler::compiler() : m_debug_output(false) {}
 
-std::string compiler::compile(const std::string &source) const {
+std::string compiler::compile(const std::string &source, code_map *map) const {
     program_t program = parse(source);
-    return generate(program);
+    return generate(program, map);
 }
 
 void compiler::enable_debug_output(bool debug_output) {
     m_debug_output = debug_output;
 }
 
-std::string compiler::generate(const program_t &program) const {
+std::string compiler::generate(const program_t &program, code_map *map) const {
     build_t build(program);
     auto return_value = build.bfg.new_var("_return_value");
     // As long as all function calls are inlined, this makes sense.
@@ -64,7 +64,7 @@ std::string compiler::generate(const program_t &program) const {
     if (m_debug_output)
         return build.bfg.get_code();
     else
-        return build.bfg.get_minimal_code();
+        return build.bfg.get_minimal_code(map);
 }
 
 // ----- Helper function -------------------------------------------------------
@@ -32,13 +32,14 @@ public:
 
     compiler();
 
-    // Compile source to Brainfuck code.
-    std::string compile(const std::string &source) const;
+    // Compile source to Brainfuck code. Without debug output, the origin of
+    // the code is stored to 'map', if given.
+    std::string compile(const std::string &source, code_map *map = nullptr) const;
 
     void enable_debug_output(bool);
 
 private:
-    std::string generate(const program_t &program) const;
+    std::string generate(const program_t &program, code_map *map) const;
 
     bool m_debug_output;
 };
@@ -216,6 +216,8 @@ void expression_visitor::operator()(const expression::function_call_t &e) {
     SCOPE_EXIT {std::swap(scope, m_build.scope);};
 
     // Finally, visit all instructions in the called function.
+    m_build.bfg.push_function(e.function_name);
+    SCOPE_EXIT {m_build.bfg.pop_function();};
     instruction_visitor visitor(m_build, m_var_stack.back());
     for (const auto &instruction : function_it->instructions)
         boost::apply_visitor(visitor, instruction);
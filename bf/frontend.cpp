@@ -1,3 +1,4 @@
+#include "c_backend.h"
 #include "compiler.h"
 
 #include <boost/program_options.hpp>
@@ -14,6 +15,10 @@ int main(int argc, char **argv) {
         ("input-file,i",  po::value<std::string>(),                        "Set input file.")
         ("output-file,o", po::value<std::string>()->default_value("a.bf"), "Set output file.")
         ("debug,d",       "Debug information in output.")
+        ("emit-c,c",      "Output C source code instead of Brainfuck.")
+        ("native,n",      "Output native executable, built by the C compiler.")
+        ("cc",            po::value<std::string>()->default_value("cc -O2"), "Set C compiler and flags for --native.")
+        ("code-map,m",    po::value<std::string>(),                        "Write origin of each code range to file.")
         ("help,h",        "Print this help message.")
         ("version,v",     "Print version information.");
 
@@ -43,10 +48,32 @@ int main(int argc, char **argv) {
         bf::compiler bfc;
         if (variables.count("debug"))
             bfc.enable_debug_output(true);
-        const std::string bf_code = bfc.compile(source);
+        bf::code_map map;
+        const std::string bf_code = bfc.compile(source, &map);
 
-        std::ofstream out(variables["output-file"].as<std::string>());
-        out << bf_code;
+        if (variables.count("code-map")) {
+            // One range per line: begin, end, function, statement, operation, debug comment, comment
+            std::ofstream out(variables["code-map"].as<std::string>());
+            for (const auto &origin : map)
+                out << origin.begin << '\t' << origin.end << '\t' << origin.function << '\t'
+                    << origin.statement << '\t' << origin.operation << '\t' << origin.debug << '\t'
+                    << origin.comment << '\n';
+        }
+
+        std::string output_file = variables["output-file"].as<std::string>();
+        if (variables.count("native")) {
+            if (variables["output-file"].defaulted())
+                output_file = "a.out";
+            bf::compile_c(bf::emit_c(bf_code), output_file, variables["cc"].as<std::string>());
+        } else if (variables.count("emit-c")) {
+            if (variables["output-file"].defaulted())
+                output_file = "a.c";
+            std::ofstream out(output_file);
+            out << bf::emit_c(bf_code);
+        } else {
+            std::ofstream out(output_file);
+            out << bf_code;
+        }
     }
     catch (const std::exception &e) {
         std::cerr << "Could not compile given source code: " << e.what() << std::endl;
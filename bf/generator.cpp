@@ -1,4 +1,5 @@
 #include "generator.h"
+#include "scope_exit.h"
 
 #include <algorithm>
 #include <cassert>
@@ -27,10 +28,9 @@ std::shared_ptr<var> generator::new_var(std::string var_name, unsigned init_valu
     if (var_name.compare("") == 0)
         var_name = "_mem_addr_" + std::to_string(stack_pos);
 
-    m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_debug_nr++) + ")"
-            " Declare variable '" + var_name + "' at position " + std::to_string(stack_pos),
-            m_indention);
+    begin_operation("generator::new_var",
+            "Declare variable '" + var_name + "' at position " + std::to_string(stack_pos));
+    SCOPE_EXIT {end_operation();};
 
     auto new_var = std::shared_ptr<var>(new var(*this, var_name, stack_pos));
     new_var->set(init_value);
@@ -110,9 +110,8 @@ void generator::print(const std::string &text) {
         std::replace(comment_text.begin(), comment_text.end(), op, '_');
     std::replace(comment_text.begin(), comment_text.end(), '\n', '_');
 
-    m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_debug_nr++) + ") Print '" + comment_text + "'",
-            m_indention);
+    begin_operation("generator::print", "Print '" + comment_text + "'");
+    SCOPE_EXIT {end_operation();};
 
     // Print text (to be optimized?)
     auto pc = new_var_array<2>("_print");
@@ -132,6 +131,26 @@ void generator::print(const std::string &text) {
     }
 }
 
+void generator::push_function(const std::string &name) {
+    m_functions.push_back(name);
+    update_origin();
+}
+
+void generator::pop_function() {
+    m_functions.pop_back();
+    update_origin();
+}
+
+void generator::push_statement(const std::string &description) {
+    m_statements.push_back(description);
+    update_origin();
+}
+
+void generator::pop_statement() {
+    m_statements.pop_back();
+    update_origin();
+}
+
 std::ostream &operator<<(std::ostream &o, const generator &g) {
     const unsigned indention_factor = 4;
 
@@ -162,20 +181,33 @@ std::string generator::get_code() const {
     return ss.str();
 }
 
-std::string generator::get_minimal_code() const {
-    const std::string full_code = get_code();
-
-    // Filter all non-Brainfuck characters
+std::string generator::get_minimal_code(code_map *map) const {
+    // Filter all non-Brainfuck characters. This is the same as filtering the
+    // output of 'get_code', but the origin of each row is known here.
     std::string minimal_code;
     unsigned line_counter = 0;
-    for (const char c : full_code) {
-        if (std::find(bf_ops.begin(), bf_ops.end(), c) != bf_ops.end()) {
-            minimal_code += c;
-            if (++line_counter % 80 == 0) {
-                minimal_code += '\n';
-                line_counter = 0;
+    const origin_t none;
+    auto next_origin = m_origins.begin();
+    const origin_t *origin = &none;
+    for (std::size_t row = 0; row < m_out.size(); ++row) {
+        for (; next_origin != m_origins.end() && next_origin->first <= row; ++next_origin)
+            origin = &next_origin->second;
+
+        const std::size_t begin = minimal_code.size();
+        const auto &out = m_out[row];
+        for (const char c : std::get<0>(out) + std::get<1>(out) + std::get<2>(out)) {
+            if (std::find(bf_ops.begin(), bf_ops.end(), c) != bf_ops.end()) {
+                minimal_code += c;
+                if (++line_counter % 80 == 0) {
+                    minimal_code += '\n';
+                    line_counter = 0;
+                }
             }
         }
+
+        if (map && minimal_code.size() != begin)
+            map->push_back({begin, minimal_code.size(), origin->function, origin->statement,
+                            origin->operation, origin->debug, std::get<2>(out)});
     }
 
     // Make it look nice :)
@@ -199,6 +231,40 @@ std::string generator::move_sp_to(const var &v) {
         return std::string(-dist, '<');
 }
 
+void generator::begin_operation(const std::string &name, const std::string &comment) {
+    const std::string debug = comment.empty() ? ""
+        : "(Debug " + std::to_string(m_debug_nr++) + ") " + comment;
+    if (m_operation_depth++ == 0) {
+        m_operation = {"", "", name, debug};
+        update_origin();
+    }
+    if (!comment.empty())
+        m_out.emplace_back("", "", debug, m_indention); // NOP
+}
+
+void generator::end_operation() {
+    if (--m_operation_depth == 0) {
+        m_operation = origin_t();
+        update_origin();
+    }
+}
+
+void generator::update_origin() {
+    origin_t origin = m_operation;
+    origin.function  = m_functions.empty() ? "" : m_functions.back();
+    origin.statement = m_statements.empty() ? "" : m_statements.back();
+    if (!m_origins.empty() && m_origins.back().first == m_out.size())
+        m_origins.back().second = origin;
+    else
+        m_origins.emplace_back(m_out.size(), origin);
+}
+
+const code_origin *find_origin(const code_map &map, std::size_t offset) {
+    const auto it = std::upper_bound(map.begin(), map.end(), offset,
+        [](std::size_t o, const code_origin &origin) {return o < origin.end;});
+    return it != map.end() && it->begin <= offset ? &*it : nullptr;
+}
+
 void var::increment() {
     m_gen.m_out.emplace_back(m_gen.move_sp_to(*this),
             "+",
@@ -214,6 +280,14 @@ void var::decrement() {
 }
 
 void var::set(unsigned value) {
+    if (value > max_plain_constant) {
+        m_gen.begin_operation("var::set", "Set '" + m_name + "' to " + std::to_string(value));
+        SCOPE_EXIT {m_gen.end_operation();};
+        this->set(0);
+        this->add(value);
+        return;
+    }
+
     m_gen.m_out.emplace_back(m_gen.move_sp_to(*this),
             "[-]" + std::string(value, '+'),
             "Set '" + m_name + "' to " + std::to_string(value),
@@ -221,6 +295,13 @@ void var::set(unsigned value) {
 }
 
 void var::add(unsigned value) {
+    if (value > max_plain_constant) {
+        m_gen.begin_operation("var::add", "Add " + std::to_string(value) + " to '" + m_name + "'");
+        SCOPE_EXIT {m_gen.end_operation();};
+        add_constant(value, true);
+        return;
+    }
+
     m_gen.m_out.emplace_back(m_gen.move_sp_to(*this),
             std::string(value, '+'),
             "Add " + std::to_string(value) + " to '" + m_name + "'",
@@ -228,17 +309,35 @@ void var::add(unsigned value) {
 }
 
 void var::subtract(unsigned value) {
+    if (value > max_plain_constant) {
+        m_gen.begin_operation("var::subtract", "Subtract " + std::to_string(value) + " from '" + m_name + "'");
+        SCOPE_EXIT {m_gen.end_operation();};
+        add_constant(value, false);
+        return;
+    }
+
     m_gen.m_out.emplace_back(m_gen.move_sp_to(*this),
             std::string(value, '-'),
             "Subtract " + std::to_string(value) + " from '" + m_name + "'",
             m_gen.m_indention);
 }
 
+void var::add_constant(unsigned value, bool positive) {
+    // value = (value / f) * f + value % f, with f close to sqrt(value)
+    const unsigned f = (unsigned) std::sqrt(value);
+    auto counter = m_gen.new_var("_constant", value / f);
+    m_gen.while_begin(*counter);
+    {
+        positive ? this->add(f) : this->subtract(f);
+        counter->decrement();
+    }
+    m_gen.while_end(*counter);
+    positive ? this->add(value % f) : this->subtract(value % f);
+}
+
 void var::multiply(unsigned value) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Multiply '" + m_name + "' by " + std::to_string(value),
-            m_gen.m_indention);
+    m_gen.begin_operation("var::multiply", "Multiply '" + m_name + "' by " + std::to_string(value));
+    SCOPE_EXIT {m_gen.end_operation();};
 
     auto temp = m_gen.new_var("_multiply");
     temp->move(*this);
@@ -268,10 +367,8 @@ void var::move(var &v) {
     if (&v == this)
         return;
 
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Move from '" + v.m_name + "' to '" + m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::move", "Move from '" + v.m_name + "' to '" + m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     this->set(0);
     m_gen.while_begin(v);
@@ -286,10 +383,8 @@ void var::copy(const var &v) {
     if (&v == this)
         return;
 
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Copy from '" + v.m_name + "' to '" + m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::copy", "Copy from '" + v.m_name + "' to '" + m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     // Break v temporarily
     auto v_ptr = const_cast<var*>(&v);
@@ -307,10 +402,8 @@ void var::copy(const var &v) {
 }
 
 void var::add(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Add '" + v.m_name + "' to '" + m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::add", "Add '" + v.m_name + "' to '" + m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     auto temp = m_gen.new_var("_add");
     if (&v != this) {
@@ -338,10 +431,8 @@ void var::add(const var &v) {
 }
 
 void var::subtract(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Subtract '" + v.m_name + "' from '" + m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::subtract", "Subtract '" + v.m_name + "' from '" + m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     if (&v != this) {
         // Break v temporarily
@@ -361,10 +452,8 @@ void var::subtract(const var &v) {
 }
 
 void var::multiply(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Multiply '" + v.m_name + "' with '" + m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::multiply", "Multiply '" + v.m_name + "' with '" + m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     auto temp = m_gen.new_var("_multiply");
     if (&v != this) {
@@ -389,10 +478,8 @@ void var::multiply(const var &v) {
 }
 
 void var::bool_not(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Set '" + m_name + "' to (bool) not '" + v.m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::bool_not", "Set '" + m_name + "' to (bool) not '" + v.m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     // array = {1 (result), a}
     auto array = m_gen.new_var_array<2>("_not");
@@ -412,10 +499,8 @@ void var::bool_not(const var &v) {
 }
 
 void var::bool_and(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Set '" + m_name + "' to '" + m_name + "' (bool) and '" + v.m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::bool_and", "Set '" + m_name + "' to '" + m_name + "' (bool) and '" + v.m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     if (&v != this) {
         // array = {0 (result), a, b}
@@ -449,10 +534,8 @@ void var::bool_and(const var &v) {
 }
 
 void var::bool_or(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Set '" + m_name + "' to '" + m_name + "' (bool) or '" + v.m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::bool_or", "Set '" + m_name + "' to '" + m_name + "' (bool) or '" + v.m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     if (&v != this) {
         // array = {0, a (result), b}
@@ -487,10 +570,8 @@ void var::bool_or(const var &v) {
 }
 
 void var::lower_than(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Compare '" + m_name + "' lower than '" + v.m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::lower_than", "Compare '" + m_name + "' lower than '" + v.m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     if (&v != this) {
         // Similar to http://stackoverflow.com/a/13327857
@@ -518,6 +599,9 @@ void var::lower_than(const var &v) {
 }
 
 void var::lower_equal(const var &v) {
+    m_gen.begin_operation("var::lower_equal");
+    SCOPE_EXIT {m_gen.end_operation();};
+
     if (&v != this) {
         // (this <= v) == (this < v + 1)
         auto v_1 = m_gen.new_var("_1_plus_" + v.m_name);
@@ -529,6 +613,9 @@ void var::lower_equal(const var &v) {
 }
 
 void var::greater_than(const var &v) {
+    m_gen.begin_operation("var::greater_than");
+    SCOPE_EXIT {m_gen.end_operation();};
+
     if (&v != this) {
         // (this > v) == (v < this)
         auto v_copy = m_gen.new_var("_copy_" + v.m_name);
@@ -540,6 +627,9 @@ void var::greater_than(const var &v) {
 }
 
 void var::greater_equal(const var &v) {
+    m_gen.begin_operation("var::greater_equal");
+    SCOPE_EXIT {m_gen.end_operation();};
+
     if (&v != this) {
         // (this >= v) == (v <= this)
         auto v_copy = m_gen.new_var("_copy_" + v.m_name);
@@ -551,10 +641,8 @@ void var::greater_equal(const var &v) {
 }
 
 void var::equal(const var &v) {
-    m_gen.m_out.emplace_back("", "", // NOP
-            "(Debug " + std::to_string(m_gen.m_debug_nr++) + ")"
-            " Compare '" + m_name + "' equal to '" + v.m_name + "'",
-            m_gen.m_indention);
+    m_gen.begin_operation("var::equal", "Compare '" + m_name + "' equal to '" + v.m_name + "'");
+    SCOPE_EXIT {m_gen.end_operation();};
 
     if (&v != this) {
         // Similar to http://stackoverflow.com/a/13327857
@@ -583,6 +671,9 @@ void var::equal(const var &v) {
 }
 
 void var::not_equal(const var &v) {
+    m_gen.begin_operation("var::not_equal");
+    SCOPE_EXIT {m_gen.end_operation();};
+
     if (&v != this) {
         auto temp = m_gen.new_var("_equal");
         temp->copy(*this);
@@ -7,17 +7,36 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <map>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 namespace bf {
 
 static const std::string bf_ops = "><+-.,[]";
 
+// Origin of a range of the minimal code (see "generator::get_minimal_code").
+struct code_origin {
+    std::size_t begin;     // Offset of first Brainfuck operation
+    std::size_t end;       // Behind offset of last Brainfuck operation
+    std::string function;  // Innermost function of the source program, if known
+    std::string statement; // Innermost statement of the source program, if known
+    std::string operation; // Outermost operation of the generator, e.g. "var::multiply"
+    std::string debug;     // Debug comment of that operation, e.g. "(Debug 4) Multiply 'a' by 3"
+    std::string comment;   // Comment of the row, e.g. "Increment 'a'"
+};
+
+// Sorted by offset. Offsets not covered (e.g. line breaks) have no origin.
+using code_map = std::vector<code_origin>;
+
+// Origin of the code at 'offset' or nullptr, if there is none.
+const code_origin *find_origin(const code_map &map, std::size_t offset);
+
 class var;
 
 class generator {
@@ -56,9 +75,17 @@ public:
 
     void print(const std::string &text);
 
+    // Annotate all code generated until the matching pop with the function or
+    // statement of the source program it originates from.
+    void push_function(const std::string &name);
+    void pop_function();
+    void push_statement(const std::string &description);
+    void pop_statement();
+
     friend std::ostream &operator<<(std::ostream&, const generator&);
     std::string get_code() const;
-    std::string get_minimal_code() const;
+    // The origin of each row is stored to 'map', if given.
+    std::string get_minimal_code(code_map *map = nullptr) const;
 
 private:
     generator(const generator&) = delete;
@@ -66,12 +93,28 @@ private:
     // Helper function
     std::string move_sp_to(const var&);
 
+    // Operations of "generator" and "var" consisting of several rows are
+    // enclosed by these. A debug comment is emitted, if 'comment' is given.
+    void begin_operation(const std::string &name, const std::string &comment = "");
+    void end_operation();
+    void update_origin();
+
     // Output format: sp moves, operations, comment, indention
     using output_t = std::tuple<std::string, std::string, std::string, unsigned>;
     std::vector<output_t> m_out;
     unsigned              m_indention = 0;
     unsigned              m_debug_nr  = 0;
 
+    // Origin of the rows starting at the given row index
+    struct origin_t {
+        std::string function, statement, operation, debug;
+    };
+    std::vector<std::pair<std::size_t, origin_t>> m_origins;
+    std::vector<std::string>                      m_functions;
+    std::vector<std::string>                      m_statements;
+    origin_t                                      m_operation;
+    unsigned                                      m_operation_depth = 0;
+
     // TODO: Is this map really needed?
     std::map<unsigned, var*>          m_pos_to_var;
     unsigned                          m_stackpos = 0;
@@ -112,6 +155,11 @@ public:
 
 private:
     var(generator&, const std::string &var_name, unsigned stack_pos);
+
+    // Constants above this are added by a loop instead of a run of '+' or '-',
+    // so the code stays short for cells wider than 8 bit.
+    static const unsigned max_plain_constant = 255;
+    void add_constant(unsigned value, bool positive);
     var(const var&) = delete;
 
     generator         &m_gen;
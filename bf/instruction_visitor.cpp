@@ -2,6 +2,8 @@
 #include "instruction_visitor.h"
 #include "scope_exit.h"
 
+#include <algorithm>
+
 namespace bf {
 
 instruction_visitor::instruction_visitor(compiler::build_t &build, const generator::var_ptr &return_value)
@@ -9,6 +11,9 @@ instruction_visitor::instruction_visitor(compiler::build_t &build, const generat
 
 // ----- Function call ---------------------------------------------------------
 void instruction_visitor::operator()(const instruction::function_call_t &i) {
+    m_build.bfg.push_statement("Call '" + i.function_name + "'");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     // TODO: Describe this kind-of wrapper.
     auto return_value = m_build.bfg.new_var("_return_value", 0);
     expression_visitor visitor(m_build, return_value);
@@ -18,6 +23,9 @@ void instruction_visitor::operator()(const instruction::function_call_t &i) {
 
 // ----- Variable declaration --------------------------------------------------
 void instruction_visitor::operator()(const instruction::variable_declaration_t &i) {
+    m_build.bfg.push_statement("Declare '" + i.variable_name + "'");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     auto it = m_build.scope.back().find(i.variable_name);
     if (it != m_build.scope.back().end())
         throw std::logic_error("Redeclaration of variable: " + i.variable_name);
@@ -35,12 +43,18 @@ void instruction_visitor::operator()(const instruction::variable_declaration_t &
 
 // ----- Variable assignment ---------------------------------------------------
 void instruction_visitor::operator()(const instruction::variable_assignment_t &i) {
+    m_build.bfg.push_statement("Assign '" + i.variable_name + "'");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     expression_visitor visitor(m_build, m_build.get_var(i.variable_name));
     boost::apply_visitor(visitor, i.expression);
 }
 
 // ----- Print expression ------------------------------------------------------
 void instruction_visitor::operator()(const instruction::print_expression_t &i) {
+    m_build.bfg.push_statement("Print expression");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     auto expression = m_build.bfg.new_var("_expression");
     expression_visitor visitor(m_build, expression);
     boost::apply_visitor(visitor, i.expression);
@@ -49,6 +63,9 @@ void instruction_visitor::operator()(const instruction::print_expression_t &i) {
 
 // ----- Print text ------------------------------------------------------------
 void instruction_visitor::operator()(const instruction::print_text_t &i) {
+    m_build.bfg.push_statement("Print text");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     std::string text = i.text;
     // Replace character sequence "\n" with character '\n' and so on...
     // TODO: This can be enhanced for sure.
@@ -67,17 +84,26 @@ void instruction_visitor::operator()(const instruction::print_text_t &i) {
 
 // ----- Scan variable ---------------------------------------------------------
 void instruction_visitor::operator()(const instruction::scan_variable_t &i) {
+    m_build.bfg.push_statement("Scan '" + i.variable_name + "'");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     m_build.get_var(i.variable_name)->read_input();
 }
 
 // ----- Return statement ------------------------------------------------------
 void instruction_visitor::operator()(const instruction::return_statement_t &i) {
+    m_build.bfg.push_statement("Return");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     expression_visitor visitor(m_build, m_return_value);
     boost::apply_visitor(visitor, i.expression);
 }
 
 // ----- Conditional statement -------------------------------------------------
 void instruction_visitor::operator()(const instruction::if_else_t &i) {
+    m_build.bfg.push_statement("If");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     auto condition = m_build.bfg.new_var("_if_condition");
     expression_visitor visitor(m_build, condition);
     boost::apply_visitor(visitor, i.condition);
@@ -101,6 +127,9 @@ void instruction_visitor::operator()(const instruction::if_else_t &i) {
 
 // ----- While loop ------------------------------------------------------------
 void instruction_visitor::operator()(const instruction::while_loop_t &i) {
+    m_build.bfg.push_statement("While");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     auto condition = m_build.bfg.new_var("_while_condition");
     expression_visitor visitor(m_build, condition);
     boost::apply_visitor(visitor, i.condition);
@@ -119,6 +148,9 @@ void instruction_visitor::operator()(const instruction::while_loop_t &i) {
 
 // ----- For loop --------------------------------------------------------------
 void instruction_visitor::operator()(const instruction::for_loop_t &i) {
+    m_build.bfg.push_statement("For");
+    SCOPE_EXIT {m_build.bfg.pop_statement();};
+
     // Provide a new scope for loop header.
     m_build.scope.emplace_back();
     SCOPE_EXIT {m_build.scope.pop_back();};
@@ -1,32 +1,146 @@
 #pragma once
 
+#include "bytecode.h"
+#include "io.h"
+#include "jit.h"
+#include "prepared_program.h"
+#include "profiler.h"
+#include "scope_exit.h"
+#include "tape.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <deque>
+#include <exception>
 #include <iterator>
-#include <map>
+#include <limits>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace bf {
 
-template <typename memory_type = unsigned char>
+// Labels as values are supported by GCC and Clang.
+#if defined(__GNUC__)
+#define BF_THREADED_DISPATCH
+#endif
+
+enum class engine {
+    switch_dispatch, // Portable dispatch loop
+    threaded,        // Threaded dispatch, if supported. Else 'switch_dispatch'.
+    jit              // Native code (x86-64, byte sized cells only)
+};
+
+// Result of 'interpreter::run'. Execution can be resumed after 'needs_input'
+// and 'budget_exhausted'.
+enum class run_status {
+    halted,          // End of program reached
+    needs_input,     // Input buffer ran empty (and the input source, if any)
+    budget_exhausted // Iteration budget or deadline of 'run_limits' reached
+};
+
+// Limits for a single call of 'interpreter::run'. Both are only checked when a
+// loop is repeated (at the back-edge), the deadline only every few thousand
+// repetitions. Without limits, an unchecked variant of the engine is used.
+struct run_limits {
+    std::uint64_t                         iterations = std::numeric_limits<std::uint64_t>::max();
+    std::chrono::steady_clock::time_point deadline   = std::chrono::steady_clock::time_point::max();
+
+    bool unlimited() const {
+        return iterations == std::numeric_limits<std::uint64_t>::max()
+            && deadline == std::chrono::steady_clock::time_point::max();
+    }
+};
+
+// Counters of all runs of an interpreter, see 'interpreter::statistics'.
+// Instruction counts are only available with a counting profiler
+// ("step_counter" or "loop_profiler"), which is not supported by the 'jit'
+// engine. Otherwise, 'counted' is false and they are 0. The first run of a
+// loop body per entry is no repeat, so 'loop_repeats' is less than the sum of
+// 'loop_profiler::loop::iterations', which counts all runs of a body.
+struct run_statistics {
+    bool          counted         = false;
+    std::uint64_t instructions    = 0; // Executed bytecode instructions
+    std::uint64_t commands        = 0; // Brainfuck commands of these (see 'source_commands')
+    std::uint64_t loop_repeats    = 0; // Back-edges taken by loops which are not folded
+    std::array<std::uint64_t, opcode_count> opcodes = {}; // Executed instructions per 'opcode'
+    std::size_t   max_cell        = 0; // Highest cell accessed or reached by the stack pointer
+    std::uint64_t cells_read      = 0; // From input (bytes, if cells are byte sized)
+    std::uint64_t cells_written   = 0; // To output
+    std::chrono::steady_clock::duration elapsed = {}; // Within 'run'
+};
+
+// Checks of the dispatch loop, chosen at compile time. Each combination gets a
+// loop of its own, which contains no trace of the checks turned off.
+//
+// 'step_budget' allows 'run_limits'. Without, 'run' only accepts unlimited
+// runs. 'bounds_checks' checks the position of each cell access against the
+// cells the tape has made accessible, e.g. to debug bytecode transformations or
+// tapes. Without, cells below zero which are only reached by a negative offset
+// hit the padding of the tape, so whether a program moving below cell 0 fails
+// depends on how its moves were folded. With, any access below zero fails.
+template <bool step_budget_, bool bounds_checks_>
+struct checks {
+    static const bool step_budget   = step_budget_;
+    static const bool bounds_checks = bounds_checks_;
+};
+
+using default_checks = checks<true, false>;
+using no_checks      = checks<false, false>;
+using all_checks     = checks<true, true>;
+
+// Cells are of 'memory_type' and behave like 'overflow_mode' if a value does not
+// fit. Saturating and trapping cells must be unsigned and have at most 32 bits.
+// Profiling ('profiler_type'), run limits and bounds checks ('checks_type') and
+// I/O tracing ('tracer_type') are policies, which cost nothing when disabled.
+template <typename memory_type = unsigned char, typename tape_type = vector_tape<memory_type>,
+          typename profiler_type = no_profiler, overflow overflow_mode = overflow::wrap,
+          typename checks_type = default_checks, typename tracer_type = no_tracer>
 class interpreter {
+    static_assert(overflow_mode == overflow::wrap
+                  || (std::is_unsigned<memory_type>::value && sizeof(memory_type) <= 4),
+                  "Saturating and trapping cells must be unsigned with at most 32 bits!");
+
 public:
-    interpreter(const std::string &program)
-        : m_program(program), m_instruction_pointer(0), m_stack_pointer(0)
+    interpreter(const std::string &program, engine e = engine::switch_dispatch)
+        : interpreter(std::make_shared<const prepared_program>(program, cells()), e) {}
+
+    // Share 'program' with other interpreters instead of lowering it again. It
+    // must be prepared for 'cells()'.
+    interpreter(std::shared_ptr<const prepared_program> program, engine e = engine::switch_dispatch)
+        : m_program(std::move(program)), m_engine(e), m_jit(nullptr), m_instruction_pointer(0),
+          m_memory(m_program->min_offset(), m_program->max_offset(), m_program->max_move()), m_stack_pointer(0),
+          m_output_limit(static_cast<std::size_t>(-1)), m_iterations_left(0), m_profiler(m_program),
+          m_tracer(m_program), m_faulted(false), m_max_cell(0), m_cells_read(0), m_cells_written(0), m_elapsed(0)
     {
-        // Find matching brackets (loops)
-        std::vector<std::size_t> loop_stack;
-        for (std::size_t ip = 0; ip < m_program.size(); ++ip) {
-            if (m_program.at(ip) == '[')
-                loop_stack.push_back(ip);
-            if (m_program.at(ip) == ']') {
-                m_loop_forward.emplace(loop_stack.back(), ip);
-                m_loop_back.emplace(ip, loop_stack.back());
-                loop_stack.pop_back();
-            }
-        }
-        // TODO: Check if loop_stack is completely unwinded.
+        if (!supports(m_engine))
+            throw std::logic_error("Engine not supported for this memory type or platform!");
+        if (m_program->cells() != cells())
+            throw std::logic_error("Program prepared for other cells!");
+        if (m_engine == engine::jit)
+            m_jit = &m_program->jit();
+        m_memory.reserve(m_stack_pointer);
+    }
+
+    static bool supports(engine e) {
+#ifdef BF_JIT
+        return e != engine::jit
+            || (sizeof(memory_type) == 1 && overflow_mode == overflow::wrap && !profiler_type::enabled
+                && !checks_type::bounds_checks && !tracer_type::enabled && tape_type::contiguous);
+#else
+        return e != engine::jit;
+#endif
+    }
+
+    static cell_type cells() {
+        return cell_type::of<memory_type>(overflow_mode);
     }
 
     void send_input(const std::vector<memory_type> &input) {
@@ -39,60 +153,603 @@ public:
         return result;
     }
 
-    void run() {
-        while (m_instruction_pointer < m_program.size()) {
-            switch (m_program.at(m_instruction_pointer)) {
-            case '>': ++m_stack_pointer;
-                      break;
-            case '<': --m_stack_pointer;
-                      break;
-            case '+': ++memory_at(m_stack_pointer);
-                      break;
-            case '-': --memory_at(m_stack_pointer);
-                      break;
-            case '.': m_output_buffer.push_back(memory_at(m_stack_pointer));
-                      break;
-            case ',': if (m_input_buffer.empty())
-                          throw std::runtime_error("Tried to read without data in input buffer!");
-                      memory_at(m_stack_pointer) = m_input_buffer.front();
-                      m_input_buffer.pop_front();
-                      break;
-            case '[': if (memory_at(m_stack_pointer) == 0)
-                          m_instruction_pointer = m_loop_forward.at(m_instruction_pointer);
-                      break;
-            case ']': if (memory_at(m_stack_pointer) != 0)
-                          m_instruction_pointer = m_loop_back.at(m_instruction_pointer);
-                      break;
-            default:  break; // No Brainfuck operation
-            }
-            ++m_instruction_pointer;
+    // Read input from 'source' whenever the input buffer runs empty.
+    void set_input(std::unique_ptr<input_source<memory_type>> source) {
+        m_input_source = std::move(source);
+    }
+
+    // Write output to 'sink' in chunks instead of buffering it for 'recv_output'.
+    // Output is flushed whenever 'run' returns or more input is needed.
+    void set_output(std::unique_ptr<output_sink<memory_type>> sink) {
+        m_output_sink  = std::move(sink);
+        m_output_limit = m_output_sink ? io_chunk_size : static_cast<std::size_t>(-1);
+        flush_output();
+    }
+
+    // Run until the program halts, needs more input or exceeds 'limits'. In the
+    // latter cases, all state is kept and 'run' can be called again (e.g. after
+    // sending more input) to continue. Throws std::logic_error on limits
+    // without the 'step_budget' check. A fault caught by "guarded_tape" skips
+    // the write back of the engine, so tape and output are those of the
+    // partial run, but instruction and stack pointer are lost. Further runs
+    // throw std::logic_error until a state is restored.
+    run_status run(const run_limits &limits = run_limits()) {
+        const bool limited = !limits.unlimited();
+        if (limited && !checks_type::step_budget)
+            throw std::logic_error("Run limits not supported by this interpreter!");
+        if (m_faulted)
+            throw std::logic_error("Interpreter faulted, restore a state to run again!");
+        m_iterations_left = limits.iterations;
+        m_deadline        = limits.deadline;
+        const auto start = std::chrono::steady_clock::now();
+        SCOPE_EXIT {m_elapsed += std::chrono::steady_clock::now() - start;};
+
+        reach(m_stack_pointer, m_instruction_pointer);
+        run_status status;
+        try {
+            status = m_memory.guard([this, limited] {
+                if (m_engine == engine::jit)
+                    return execute_jit();
+                else if (m_engine == engine::threaded)
+                    return limited ? execute<true, checks_type::step_budget>() : execute<true, false>();
+                else
+                    return limited ? execute<false, checks_type::step_budget>() : execute<false, false>();
+            }, [this] {
+                m_faulted = true;
+            });
+        } catch (...) {
+            flush_output();
+            throw;
         }
+        flush_output();
+        return status;
+    }
+
+    // Serialize the complete execution state (instruction and stack pointer,
+    // tape, buffered input and output) to a binary blob. Input source and
+    // output sink are not part of it. Trailing zero cells are omitted.
+    std::vector<char> save_state() const {
+        const std::vector<memory_type> &tape = m_memory.contents();
+        std::size_t used = tape.size();
+        while (used > 0 && tape[used - 1] == 0)
+            --used;
+
+        std::vector<char> state(state_magic, state_magic + sizeof(state_magic));
+        append(state, static_cast<std::uint64_t>(sizeof(memory_type)));
+        append(state, m_program->hash());
+        append(state, static_cast<std::uint64_t>(m_instruction_pointer));
+        append(state, static_cast<std::uint64_t>(m_stack_pointer));
+        append_cells(state, tape.data(), used);
+        append_cells(state, m_input_buffer);
+        append_cells(state, m_output_buffer.data(), m_output_buffer.size());
+        return state;
+    }
+
+    // Restore a state saved by an interpreter of the same program and memory
+    // type. Throws std::logic_error if the state belongs to another program and
+    // std::runtime_error if it is malformed.
+    void restore_state(const std::vector<char> &state) {
+        const char *position = state.data();
+        const char *const end = state.data() + state.size();
+        if (state.size() < sizeof(state_magic) || !std::equal(state_magic, state_magic + sizeof(state_magic), position))
+            throw std::runtime_error("Invalid interpreter state!");
+        position += sizeof(state_magic);
+        if (extract<std::uint64_t>(position, end) != sizeof(memory_type) ||
+                extract<std::uint64_t>(position, end) != m_program->hash())
+            throw std::logic_error("Interpreter state belongs to another program!");
+        const std::uint64_t ip = extract<std::uint64_t>(position, end);
+        const std::uint64_t sp = extract<std::uint64_t>(position, end);
+        if (ip > m_program->code().size())
+            throw std::runtime_error("Invalid interpreter state!");
+
+        std::vector<memory_type> tape, input, output;
+        extract_cells(position, end, tape);
+        extract_cells(position, end, input);
+        extract_cells(position, end, output);
+        if (position != end)
+            throw std::runtime_error("Invalid interpreter state!");
+
+        restore_state(ip, sp, tape, input, std::move(output));
+    }
+
+    // Restore a state given by its parts, e.g. to continue the execution of
+    // another engine. 'ip' must be within the program. Throws
+    // std::runtime_error if 'sp' is beyond the capacity of the tape.
+    void restore_state(std::size_t ip, std::size_t sp, const std::vector<memory_type> &tape,
+                       const std::vector<memory_type> &input, std::vector<memory_type> output) {
+        if (sp >= m_memory.capacity())
+            throw std::runtime_error("Invalid interpreter state!");
+        m_memory.load(tape.data(), tape.size());
+        m_memory.reserve(sp);
+        m_instruction_pointer = ip;
+        m_stack_pointer       = sp;
+        m_max_cell            = std::max<std::size_t>(sp, tape.empty() ? 0 : tape.size() - 1);
+        m_input_buffer.assign(input.begin(), input.end());
+        m_output_buffer.swap(output);
+        m_faulted = false;
+    }
+
+    // Counters of all runs since construction. Resetting the profiler resets
+    // the instruction counts.
+    run_statistics statistics() const {
+        run_statistics result;
+        result.max_cell      = m_max_cell;
+        result.cells_read    = m_cells_read;
+        result.cells_written = m_cells_written;
+        result.elapsed       = m_elapsed;
+        count_instructions(result, std::integral_constant<bool, profiler_type::enabled>());
+        return result;
     }
 
     // Debug and testing
     const std::vector<memory_type> &get_memory() const {
-        return m_memory;
+        return m_memory.contents();
     }
 
     std::size_t get_stack_pointer() const {
         return m_stack_pointer;
     }
 
+    const tape_type &get_tape() const {
+        return m_memory;
+    }
+
+    const profiler_type &get_profiler() const {
+        return m_profiler;
+    }
+
+    profiler_type &get_profiler() {
+        return m_profiler;
+    }
+
+    const tracer_type &get_tracer() const {
+        return m_tracer;
+    }
+
+    tracer_type &get_tracer() {
+        return m_tracer;
+    }
+
 private:
-    memory_type &memory_at(std::size_t position) {
-        if (m_memory.size() <= position)
-            m_memory.resize(position + 1);
-        return m_memory[position];
-    }
-
-    const std::string                  m_program;
-    std::size_t                        m_instruction_pointer;
-    std::vector<memory_type>           m_memory;
-    std::size_t                        m_stack_pointer;
-    std::map<std::size_t, std::size_t> m_loop_forward; // '[' position to matching ']' position
-    std::map<std::size_t, std::size_t> m_loop_back;    // ']' position to matching '[' position
-    std::deque<memory_type>            m_input_buffer;
-    mutable std::vector<memory_type>   m_output_buffer;
+    // Cells are accessed without bounds checks. The tape only needs to be
+    // reserved whenever the stack pointer is moved.
+    //
+    // Both engines share the same instruction bodies: The switch is used for
+    // the first dispatch only and each body jumps directly to the body of the
+    // next instruction, if 'threaded' dispatch is enabled. This replaces the
+    // single, shared indirect branch of the switch by one per instruction.
+    //
+    // If 'limited', taken back-edges are counted down and the limits are only
+    // checked whenever the countdown reaches 0.
+    //
+    // The profiler and tracer hooks are empty for 'no_profiler' and
+    // 'no_tracer' and optimized away, as are the bounds checks of 'cell'.
+    template <bool threaded, bool limited>
+    run_status execute() {
+        const operation *code = m_program->code().data();
+        const std::size_t size = m_program->code().size();
+        std::size_t ip = m_instruction_pointer;
+        std::size_t sp = m_stack_pointer;
+        std::uint64_t countdown = 1;
+
+        // Instruction and stack pointer are written back on every exit. No
+        // object with a destructor may live here (see 'guarded_tape::guard').
+        const auto leave = [this, &ip, &sp](run_status status) {
+            m_instruction_pointer = ip;
+            m_stack_pointer       = sp;
+            return status;
+        };
+
+#ifdef BF_THREADED_DISPATCH
+        // Same order as 'opcode'
+        static const void *const labels[] = {
+            &&op_add, &&op_move, &&op_read, &&op_write, &&op_jump_zero,
+            &&op_jump_not_zero, &&op_clear, &&op_multiply_add, &&op_scan,
+            &&op_product_add, &&op_conditional_set, &&op_write_value
+        };
+#define BF_CASE(name) case opcode::name: op_##name
+#define BF_NEXT                                    \
+        if (threaded) {                            \
+            if (ip == size)                        \
+                goto halt;                         \
+            i = code + ip++;                       \
+            m_profiler.instruction(ip - 1);        \
+            goto *labels[static_cast<int>(i->op)]; \
+        }                                          \
+        break
+#else
+#define BF_CASE(name) case opcode::name
+#define BF_NEXT       break
+#endif
+
+        try {
+            while (ip < size) {
+                const operation *i = code + ip++;
+                m_profiler.instruction(ip - 1);
+                switch (i->op) {
+                BF_CASE(add):   add(cell(sp, i->offset), i->value);
+                                BF_NEXT;
+                BF_CASE(move):  sp += i->value;
+                                m_memory.reserve(sp);
+                                reach(sp, ip);
+                                BF_NEXT;
+                BF_CASE(write): m_tracer.output(ip - 1, static_cast<std::uint64_t>(cell(sp, i->offset)));
+                                write_output(cell(sp, i->offset));
+                                BF_NEXT;
+                BF_CASE(read):  if (m_input_buffer.empty() && !fill_input()) {
+                                    --ip; // Retry after more input has been sent
+                                    return leave(run_status::needs_input);
+                                }
+                                cell(sp, i->offset) = m_input_buffer.front();
+                                m_input_buffer.pop_front();
+                                ++m_cells_read;
+                                m_tracer.input(ip - 1, static_cast<std::uint64_t>(cell(sp, i->offset)));
+                                BF_NEXT;
+                BF_CASE(jump_zero):
+                                if (cell(sp, 0) == 0)
+                                    ip = i->target;
+                                else
+                                    m_profiler.loop_entry(ip - 1);
+                                BF_NEXT;
+                BF_CASE(jump_not_zero):
+                                if (cell(sp, 0) != 0) {
+                                    ip = i->target;
+                                    m_profiler.loop_repeat(ip - 1);
+                                    if (limited && --countdown == 0 && !next_countdown(countdown))
+                                        return leave(run_status::budget_exhausted);
+                                }
+                                BF_NEXT;
+                BF_CASE(clear): cell(sp, i->offset) = 0;
+                                BF_NEXT;
+                BF_CASE(multiply_add): {
+                                // Cells are not touched if the loop would not run at all.
+                                const memory_type factor = cell(sp, 0);
+                                if (factor != 0)
+                                    add_product(cell(sp, i->offset), factor, i->value);
+                                BF_NEXT;
+                                }
+                BF_CASE(scan):  sp = scan(sp, i->value);
+                                m_memory.reserve(sp);
+                                reach(sp, ip);
+                                BF_NEXT;
+                BF_CASE(product_add): {
+                                // Only emitted for wrapping cells. Cells are not
+                                // touched if the loop would not run at all.
+                                const memory_type current = cell(sp, 0);
+                                if (current != 0) {
+                                    const memory_type factor = multiply(current, cell(sp, i->source()));
+                                    cell(sp, i->offset) += multiply(factor, i->value);
+                                }
+                                BF_NEXT;
+                                }
+                BF_CASE(conditional_set):
+                                if (cell(sp, 0) != 0)
+                                    cell(sp, i->offset) = static_cast<memory_type>(i->value);
+                                BF_NEXT;
+                BF_CASE(write_value):
+                                m_tracer.output(ip - 1, static_cast<std::uint64_t>(static_cast<memory_type>(i->value)));
+                                write_output(static_cast<memory_type>(i->value));
+                                BF_NEXT;
+                }
+            }
+#undef BF_CASE
+#undef BF_NEXT
+
+#ifdef BF_THREADED_DISPATCH
+        halt:
+#endif
+            return leave(run_status::halted);
+        } catch (...) {
+            m_instruction_pointer = ip;
+            m_stack_pointer       = sp;
+            throw;
+        }
+    }
+
+    void count_instructions(run_statistics&, std::false_type) const {}
+
+    // Sum up the executions per instruction of the profiler.
+    void count_instructions(run_statistics &result, std::true_type) const {
+        const code_view code = m_program->code();
+        const std::vector<std::uint64_t> &executions = m_profiler.executions();
+        const std::vector<std::uint32_t> commands = source_commands(m_program->source(), m_program->positions());
+        for (std::size_t ip = 0; ip < code.size(); ++ip) {
+            result.instructions += executions[ip];
+            result.commands += executions[ip] * commands[ip];
+            result.opcodes[static_cast<std::size_t>(code[ip].op)] += executions[ip];
+        }
+        result.loop_repeats = m_profiler.repeats();
+        result.counted = true;
+    }
+
+    // Raise the highest cell reached to the highest one accessed from
+    // instruction 'ip' on, before the stack pointer 'sp' moves again.
+    void reach(std::size_t sp, std::size_t ip) {
+        m_max_cell = std::max<std::size_t>(m_max_cell, sp + m_program->reach_offsets()[ip]);
+    }
+
+    // Cell at 'offset' from the stack pointer 'sp'. Cells which the tape has
+    // not made accessible (e.g. beyond its padding) are caught with
+    // 'bounds_checks'.
+    memory_type &cell(std::size_t sp, std::int32_t offset) {
+        if (checks_type::bounds_checks && !m_memory.accessible(sp + offset))
+            throw std::runtime_error("Cell access out of bounds!");
+        return m_memory[sp + offset];
+    }
+
+    // Native code needs contiguous cells, other tapes are rejected by 'supports'.
+    run_status execute_jit() {
+        return execute_jit(std::integral_constant<bool, tape_type::contiguous>());
+    }
+
+    run_status execute_jit(std::false_type) {
+        throw std::logic_error("Engine not supported for this memory type or platform!");
+    }
+
+    // Run native code until the program halts. The native code leaves
+    // whenever the tape has to be reserved and is entered again afterwards.
+    // Exceptions of the input source or output sink cannot pass the native
+    // code, so they are caught in the callbacks and thrown again afterwards.
+    // They are kept in 'm_callback_error', as no object with a destructor may
+    // live here (see 'guarded_tape::guard').
+    run_status execute_jit(std::true_type) {
+        jit_context context;
+        context.user  = this;
+        context.read  = [](void *user) -> int {
+            interpreter &self = *static_cast<interpreter*>(user);
+            auto &input = self.m_input_buffer;
+            try {
+                if (input.empty() && !self.fill_input())
+                    return -1;
+            } catch (...) {
+                self.m_callback_error = std::current_exception();
+                return -1;
+            }
+            const int value = static_cast<unsigned char>(input.front());
+            input.pop_front();
+            ++self.m_cells_read;
+            return value;
+        };
+        context.write = [](void *user, unsigned char value) -> int {
+            interpreter &self = *static_cast<interpreter*>(user);
+            try {
+                self.write_output(value);
+            } catch (...) {
+                self.m_callback_error = std::current_exception();
+                return -1;
+            }
+            return 0;
+        };
+
+        // Unlimited runs count down from a value which is never reached.
+        context.countdown = m_iterations_left == std::numeric_limits<std::uint64_t>::max()
+            && m_deadline == std::chrono::steady_clock::time_point::max() ? m_iterations_left : 1;
+
+        for (;;) {
+            context.base     = reinterpret_cast<unsigned char*>(m_memory.data());
+            context.reserved = m_memory.reserved();
+            context.max_cell = m_max_cell;
+            const jit_exit reason = m_jit->run(context, context.base + m_stack_pointer, m_instruction_pointer);
+            m_instruction_pointer = context.instruction_pointer;
+            m_stack_pointer       = context.cell - context.base;
+            m_max_cell            = context.max_cell;
+
+            if (m_callback_error) {
+                std::exception_ptr error;
+                std::swap(error, m_callback_error);
+                std::rethrow_exception(error);
+            }
+            if (reason == jit_exit::halted)
+                return run_status::halted;
+            if (reason == jit_exit::needs_input)
+                return run_status::needs_input;
+            if (reason == jit_exit::countdown) {
+                if (!next_countdown(context.countdown))
+                    return run_status::budget_exhausted;
+                continue;
+            }
+            m_memory.reserve(m_stack_pointer);
+            if (m_stack_pointer >= m_memory.reserved())
+                throw std::runtime_error("Stack pointer moved below zero!");
+            reach(m_stack_pointer, m_instruction_pointer);
+        }
+    }
+
+    // Called when the countdown of back-edges reached 0. The back-edge which
+    // reached 0 is allowed, if the limits are not exceeded yet. Then, the
+    // next countdown covers as many back-edges as allowed, but at most
+    // 'deadline_interval' if there is a deadline.
+    bool next_countdown(std::uint64_t &countdown) {
+        static const std::uint64_t deadline_interval = 1 << 14;
+        const bool has_deadline = m_deadline != std::chrono::steady_clock::time_point::max();
+        if (m_iterations_left == 0 || (has_deadline && std::chrono::steady_clock::now() >= m_deadline))
+            return false;
+        --m_iterations_left;
+        const std::uint64_t free = has_deadline ? std::min(m_iterations_left, deadline_interval - 1)
+                                                : m_iterations_left;
+        m_iterations_left -= free;
+        countdown = free + 1;
+        return true;
+    }
+
+    // Refill the empty input buffer with a chunk from the input source. Pending
+    // output is flushed first, as it may be a prompt for the requested input.
+    bool fill_input() {
+        if (!m_input_source)
+            return false;
+        flush_output();
+        memory_type chunk[io_chunk_size];
+        const std::size_t count = m_input_source->read(chunk, io_chunk_size);
+        m_input_buffer.insert(m_input_buffer.end(), chunk, chunk + count);
+        return count != 0;
+    }
+
+    void write_output(memory_type value) {
+        ++m_cells_written;
+        m_output_buffer.push_back(value);
+        if (m_output_buffer.size() >= m_output_limit)
+            flush_output();
+    }
+
+    void flush_output() {
+        if (m_output_sink && !m_output_buffer.empty()) {
+            m_output_sink->write(m_output_buffer.data(), m_output_buffer.size());
+            m_output_buffer.clear();
+        }
+    }
+
+    // Serialization helpers for 'save_state' and 'restore_state'. Values are
+    // stored in native byte order.
+    static constexpr char state_magic[4] = {'B', 'F', 'S', '1'};
+
+    template <typename value_type>
+    static void append(std::vector<char> &state, const value_type &value) {
+        const char *bytes = reinterpret_cast<const char*>(&value);
+        state.insert(state.end(), bytes, bytes + sizeof(value));
+    }
+
+    static void append_cells(std::vector<char> &state, const memory_type *cells, std::size_t count) {
+        append(state, static_cast<std::uint64_t>(count));
+        const char *bytes = reinterpret_cast<const char*>(cells);
+        state.insert(state.end(), bytes, bytes + count * sizeof(memory_type));
+    }
+
+    static void append_cells(std::vector<char> &state, const std::deque<memory_type> &cells) {
+        append(state, static_cast<std::uint64_t>(cells.size()));
+        for (const memory_type cell : cells)
+            append(state, cell);
+    }
+
+    template <typename value_type>
+    static value_type extract(const char *&position, const char *end) {
+        if (static_cast<std::size_t>(end - position) < sizeof(value_type))
+            throw std::runtime_error("Invalid interpreter state!");
+        value_type value;
+        std::memcpy(&value, position, sizeof(value));
+        position += sizeof(value);
+        return value;
+    }
+
+    static void extract_cells(const char *&position, const char *end, std::vector<memory_type> &cells) {
+        const std::uint64_t count = extract<std::uint64_t>(position, end);
+        if (count > static_cast<std::size_t>(end - position) / sizeof(memory_type))
+            throw std::runtime_error("Invalid interpreter state!");
+        cells.resize(count);
+        std::memcpy(cells.data(), position, count * sizeof(memory_type));
+        position += count * sizeof(memory_type);
+    }
+
+    // Multiply with wrap around, avoiding signed overflow of promoted operands.
+    template <typename factor_type>
+    static memory_type multiply(memory_type a, factor_type b) {
+        return static_cast<memory_type>(static_cast<unsigned long long>(a) * static_cast<unsigned long long>(b));
+    }
+
+    // Add 'delta' to 'cell' according to 'overflow_mode'. Only wrapping cells
+    // may be signed, so the others fit into std::int64_t with any delta.
+    static void add(memory_type &cell, std::int64_t delta) {
+        if (overflow_mode == overflow::wrap) {
+            cell += static_cast<memory_type>(delta);
+            return;
+        }
+        const std::int64_t max = static_cast<std::int64_t>(std::numeric_limits<memory_type>::max());
+        const std::int64_t result = static_cast<std::int64_t>(cell) + delta;
+        if (result >= 0 && result <= max)
+            cell = static_cast<memory_type>(result);
+        else if (overflow_mode == overflow::trap)
+            throw std::runtime_error("Cell overflow!");
+        else
+            cell = result < 0 ? 0 : static_cast<memory_type>(max);
+    }
+
+    // Add 'factor' times 'value' to 'cell', as a folded loop adding 'value' in
+    // each of 'factor' iterations does. Products out of range are replaced by
+    // one just out of range, so they still saturate or trap.
+    static void add_product(memory_type &cell, memory_type factor, std::int32_t value) {
+        if (overflow_mode == overflow::wrap) {
+            cell += multiply(factor, value);
+            return;
+        }
+        const std::uint64_t max = std::numeric_limits<memory_type>::max();
+        const std::uint64_t count = static_cast<std::uint64_t>(factor);
+        const std::uint64_t magnitude = value < 0 ? -static_cast<std::int64_t>(value) : value;
+        const std::uint64_t product = magnitude != 0 && count > max / magnitude ? max + 1 : count * magnitude;
+        add(cell, value < 0 ? -static_cast<std::int64_t>(product) : static_cast<std::int64_t>(product));
+    }
+
+    // Move 'position' by 'stride' until a zero cell is found.
+    std::size_t scan(std::size_t position, std::int32_t stride) {
+        return scan(position, stride, std::integral_constant<bool, tape_type::contiguous>());
+    }
+
+    // Cells are only reachable one by one, untouched pages are read as 0.
+    std::size_t scan(std::size_t position, std::int32_t stride, std::false_type) {
+        while (cell(position, 0) != 0) {
+            if (stride < 0 && position < static_cast<std::size_t>(-(std::int64_t) stride))
+                throw std::runtime_error("Stack pointer moved below zero!");
+            position += stride;
+        }
+        return position;
+    }
+
+    // Cells behind the end of the tape are 0. Byte sized cells are searched
+    // with memchr/memrchr.
+    std::size_t scan(std::size_t position, std::int32_t stride, std::true_type) const {
+        const memory_type *data = m_memory.data();
+        const std::size_t size = m_memory.size();
+        if (position >= size)
+            return position;
+
+        if (stride > 0) {
+            if (sizeof(memory_type) == 1 && stride == 1) {
+                const void *zero = std::memchr(data + position, 0, size - position);
+                return zero ? static_cast<const memory_type*>(zero) - data : size;
+            }
+            while (position < size && data[position] != 0)
+                position += stride;
+        } else {
+#ifdef __GLIBC__
+            if (sizeof(memory_type) == 1 && stride == -1) {
+                const void *zero = memrchr(data, 0, position + 1);
+                if (zero == nullptr)
+                    throw std::runtime_error("Stack pointer moved below zero!");
+                return static_cast<const memory_type*>(zero) - data;
+            }
+#endif
+            while (data[position] != 0) {
+                if (position < static_cast<std::size_t>(-(std::int64_t) stride))
+                    throw std::runtime_error("Stack pointer moved below zero!");
+                position += stride;
+            }
+        }
+        return position;
+    }
+
+    const std::shared_ptr<const prepared_program> m_program;
+    const engine                     m_engine;
+    const jit_program                *m_jit; // Owned by m_program
+    std::size_t                      m_instruction_pointer;
+    tape_type                        m_memory;
+    std::size_t                      m_stack_pointer;
+    std::deque<memory_type>          m_input_buffer;
+    mutable std::vector<memory_type> m_output_buffer;
+    std::unique_ptr<input_source<memory_type>> m_input_source;
+    std::unique_ptr<output_sink<memory_type>>  m_output_sink;
+    std::size_t                      m_output_limit; // Flush to sink at this size
+    std::uint64_t                    m_iterations_left; // Back-edges not covered by countdown
+    std::chrono::steady_clock::time_point m_deadline;
+    profiler_type                    m_profiler;
+    tracer_type                      m_tracer;
+    std::exception_ptr               m_callback_error; // Of the native code callbacks
+    bool                             m_faulted; // Until a state is restored
+    std::size_t                      m_max_cell;
+    std::uint64_t                    m_cells_read;
+    std::uint64_t                    m_cells_written;
+    std::chrono::steady_clock::duration m_elapsed; // Within 'run'
 };
 
+template <typename memory_type, typename tape_type, typename profiler_type, overflow overflow_mode,
+          typename checks_type, typename tracer_type>
+constexpr char interpreter<memory_type, tape_type, profiler_type, overflow_mode, checks_type, tracer_type>::state_magic[4];
+
 } // namespace bf
@@ -0,0 +1,168 @@
+/* Input sources and output sinks for "interpreter". Instead of buffering all
+ * input and output in memory, the interpreter pulls input from a source and
+ * pushes output to a sink in chunks of at most 'io_chunk_size' cells, so memory
+ * usage does not depend on the amount of data passing through a program.
+ *
+ * Sources and sinks for streams and file descriptors transfer one byte per
+ * cell. Callbacks transfer cells as they are.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace bf {
+
+const std::size_t io_chunk_size = 4096; // Cells
+
+template <typename memory_type>
+class input_source {
+public:
+    virtual ~input_source() = default;
+
+    // Read up to 'size' cells to 'buffer'. Returns 0 if no input is available.
+    virtual std::size_t read(memory_type *buffer, std::size_t size) = 0;
+};
+
+template <typename memory_type>
+class output_sink {
+public:
+    virtual ~output_sink() = default;
+
+    // Write all 'size' cells from 'buffer'.
+    virtual void write(const memory_type *buffer, std::size_t size) = 0;
+};
+
+template <typename memory_type>
+class stream_source : public input_source<memory_type> {
+public:
+    explicit stream_source(std::istream &stream) : m_stream(stream) {}
+
+    std::size_t read(memory_type *buffer, std::size_t size) override {
+        char bytes[io_chunk_size];
+        m_stream.read(bytes, std::min(size, io_chunk_size));
+        const std::size_t count = static_cast<std::size_t>(m_stream.gcount());
+        for (std::size_t i = 0; i < count; ++i)
+            buffer[i] = static_cast<unsigned char>(bytes[i]);
+        return count;
+    }
+
+private:
+    std::istream &m_stream;
+};
+
+template <typename memory_type>
+class stream_sink : public output_sink<memory_type> {
+public:
+    explicit stream_sink(std::ostream &stream) : m_stream(stream) {}
+
+    void write(const memory_type *buffer, std::size_t size) override {
+        char bytes[io_chunk_size];
+        for (std::size_t done = 0; done < size; done += io_chunk_size) {
+            const std::size_t count = std::min(size - done, io_chunk_size);
+            for (std::size_t i = 0; i < count; ++i)
+                bytes[i] = static_cast<char>(buffer[done + i]);
+            if (!m_stream.write(bytes, count))
+                throw std::runtime_error("Could not write to output stream!");
+        }
+        m_stream.flush();
+    }
+
+private:
+    std::ostream &m_stream;
+};
+
+#ifndef _WIN32
+// Does not take ownership of the file descriptor.
+template <typename memory_type>
+class fd_source : public input_source<memory_type> {
+public:
+    explicit fd_source(int fd) : m_fd(fd) {}
+
+    std::size_t read(memory_type *buffer, std::size_t size) override {
+        unsigned char bytes[io_chunk_size];
+        ssize_t count;
+        do
+            count = ::read(m_fd, bytes, std::min(size, io_chunk_size));
+        while (count < 0 && errno == EINTR);
+        if (count < 0)
+            throw std::runtime_error("Could not read from file descriptor!");
+        for (ssize_t i = 0; i < count; ++i)
+            buffer[i] = bytes[i];
+        return static_cast<std::size_t>(count);
+    }
+
+private:
+    const int m_fd;
+};
+
+// Does not take ownership of the file descriptor.
+template <typename memory_type>
+class fd_sink : public output_sink<memory_type> {
+public:
+    explicit fd_sink(int fd) : m_fd(fd) {}
+
+    void write(const memory_type *buffer, std::size_t size) override {
+        unsigned char bytes[io_chunk_size];
+        for (std::size_t done = 0; done < size;) {
+            const std::size_t count = std::min(size - done, io_chunk_size);
+            for (std::size_t i = 0; i < count; ++i)
+                bytes[i] = static_cast<unsigned char>(buffer[done + i]);
+            for (std::size_t written = 0; written < count;) {
+                const ssize_t result = ::write(m_fd, bytes + written, count - written);
+                if (result < 0 && errno != EINTR)
+                    throw std::runtime_error("Could not write to file descriptor!");
+                if (result > 0)
+                    written += result;
+            }
+            done += count;
+        }
+    }
+
+private:
+    const int m_fd;
+};
+#endif
+
+template <typename memory_type>
+class callback_source : public input_source<memory_type> {
+public:
+    using callback = std::function<std::size_t(memory_type *buffer, std::size_t size)>;
+
+    explicit callback_source(callback f) : m_callback(std::move(f)) {}
+
+    std::size_t read(memory_type *buffer, std::size_t size) override {
+        return m_callback(buffer, size);
+    }
+
+private:
+    callback m_callback;
+};
+
+template <typename memory_type>
+class callback_sink : public output_sink<memory_type> {
+public:
+    using callback = std::function<void(const memory_type *buffer, std::size_t size)>;
+
+    explicit callback_sink(callback f) : m_callback(std::move(f)) {}
+
+    void write(const memory_type *buffer, std::size_t size) override {
+        m_callback(buffer, size);
+    }
+
+private:
+    callback m_callback;
+};
+
+} // namespace bf
@@ -0,0 +1,270 @@
+#include "jit.h"
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+
+#ifdef BF_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace bf {
+
+#ifdef BF_JIT
+static_assert(offsetof(jit_context, base)                ==  0, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, reserved)            ==  8, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, cell)                == 16, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, instruction_pointer) == 24, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, user)                == 32, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, read)                == 40, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, write)               == 48, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, countdown)           == 56, "Unexpected jit_context layout");
+static_assert(offsetof(jit_context, max_cell)            == 64, "Unexpected jit_context layout");
+
+namespace {
+
+// Register usage: rbx = current cell, r12 = context, r13 = cell 0,
+// r14 = number of reserved cells, r15 = countdown of taken back-edges,
+// rbp = highest cell reached. All of them are callee-saved.
+class assembler {
+public:
+    void emit(std::initializer_list<unsigned char> bytes) {
+        m_code.insert(m_code.end(), bytes);
+    }
+
+    void emit32(std::uint32_t value) {
+        for (int i = 0; i < 4; ++i)
+            m_code.push_back((value >> (8 * i)) & 0xff);
+    }
+
+    // Emit a 32 bit displacement to be patched later, return its position.
+    std::size_t emit_rel32() {
+        emit32(0);
+        return m_code.size() - 4;
+    }
+
+    void patch_rel32(std::size_t position, std::size_t target) {
+        const std::uint32_t rel = (std::uint32_t) (target - (position + 4));
+        std::memcpy(&m_code[position], &rel, 4);
+    }
+
+    std::size_t size() const {return m_code.size();}
+    const std::vector<unsigned char> &code() const {return m_code;}
+
+private:
+    std::vector<unsigned char> m_code;
+};
+
+struct exit_stub {
+    std::size_t   rel32;  // Position of jump displacement to the stub
+    std::uint32_t instruction_pointer;
+    jit_exit      reason;
+};
+
+// Leave with 'reason', continue at 'ip' on next entry.
+void emit_exit(assembler &a, std::uint32_t ip, jit_exit reason, std::size_t epilogue) {
+    a.emit({0x41, 0xc7, 0x44, 0x24, 0x18}); a.emit32(ip);  // mov dword [r12+24], ip
+    a.emit({0xb8}); a.emit32((std::uint32_t) reason);     // mov eax, reason
+    a.emit({0xe9}); a.patch_rel32(a.emit_rel32(), epilogue); // jmp epilogue
+}
+
+// Leave with 'reserve', if rbx is not within the reserved cells.
+void emit_bounds_check(assembler &a, std::uint32_t ip, std::vector<exit_stub> &stubs) {
+    a.emit({0x48, 0x89, 0xd8});       // mov rax, rbx
+    a.emit({0x4c, 0x29, 0xe8});       // sub rax, r13
+    a.emit({0x4c, 0x39, 0xf0});       // cmp rax, r14
+    a.emit({0x0f, 0x83});             // jae stub
+    stubs.push_back({a.emit_rel32(), ip, jit_exit::reserve});
+}
+
+// Raise the highest cell reached to rbx plus 'reach', if below.
+void emit_reach(assembler &a, std::int32_t reach) {
+    a.emit({0x48, 0x8d, 0x83}); a.emit32(reach); // lea rax, [rbx+reach]
+    a.emit({0x48, 0x39, 0xe8});       // cmp rax, rbp
+    a.emit({0x76, 0x03});             // jbe next (rarely raised, so no cmov)
+    a.emit({0x48, 0x89, 0xc5});       // mov rbp, rax
+}
+
+} // namespace
+#endif
+
+jit_program::jit_program(code_view code, const std::vector<std::int32_t> &reach_offsets)
+    : m_code(nullptr), m_size(0) {
+#ifdef BF_JIT
+    assembler a;
+
+    // Prologue: Entry address is given as third argument.
+    a.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx, r12-r15
+    a.emit({0x55});                   // push rbp
+    a.emit({0x48, 0x83, 0xec, 0x08}); // sub rsp, 8 (align calls)
+    a.emit({0x49, 0x89, 0xfc});       // mov r12, rdi
+    a.emit({0x48, 0x89, 0xf3});       // mov rbx, rsi
+    a.emit({0x4d, 0x8b, 0x2c, 0x24}); // mov r13, [r12]
+    a.emit({0x4d, 0x8b, 0x74, 0x24, 0x08}); // mov r14, [r12+8]
+    a.emit({0x4d, 0x8b, 0x7c, 0x24, 0x38}); // mov r15, [r12+56]
+    a.emit({0x49, 0x8b, 0x6c, 0x24, 0x40}); // mov rbp, [r12+64]
+    a.emit({0x4c, 0x01, 0xed});       // add rbp, r13
+    a.emit({0xff, 0xe2});             // jmp rdx
+
+    // Epilogue: Store current cell, countdown, highest cell and return value in eax.
+    const std::size_t epilogue = a.size();
+    a.emit({0x49, 0x89, 0x5c, 0x24, 0x10}); // mov [r12+16], rbx
+    a.emit({0x4d, 0x89, 0x7c, 0x24, 0x38}); // mov [r12+56], r15
+    a.emit({0x4c, 0x29, 0xed});       // sub rbp, r13
+    a.emit({0x49, 0x89, 0x6c, 0x24, 0x40}); // mov [r12+64], rbp
+    a.emit({0x48, 0x83, 0xc4, 0x08}); // add rsp, 8
+    a.emit({0x5d});                   // pop rbp
+    a.emit({0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b}); // pop r15-r12, rbx
+    a.emit({0xc3});                   // ret
+
+    std::vector<std::pair<std::size_t, std::uint32_t>> jumps; // rel32 position, target ip
+    std::vector<exit_stub> stubs;
+
+    for (std::uint32_t ip = 0; ip < code.size(); ++ip) {
+        const operation &o = code[ip];
+        m_entry.push_back((std::uint32_t) a.size());
+
+        switch (o.op) {
+        case opcode::add:
+            a.emit({0x80, 0x83}); a.emit32(o.offset);             // add byte [rbx+offset], value
+            a.emit({(unsigned char) o.value});
+            break;
+        case opcode::move:
+            a.emit({0x48, 0x81, 0xc3}); a.emit32(o.value);        // add rbx, value
+            emit_bounds_check(a, ip + 1, stubs);
+            // Cells up to the stack pointer before are reached already.
+            if (o.value + reach_offsets[ip + 1] > 0)
+                emit_reach(a, reach_offsets[ip + 1]);
+            break;
+        case opcode::write:
+            a.emit({0x0f, 0xb6, 0xb3}); a.emit32(o.offset);       // movzx esi, byte [rbx+offset]
+            a.emit({0x49, 0x8b, 0x7c, 0x24, 0x20});               // mov rdi, [r12+32]
+            a.emit({0x41, 0xff, 0x54, 0x24, 0x30});               // call [r12+48]
+            a.emit({0x85, 0xc0});                                 // test eax, eax
+            a.emit({0x0f, 0x88});                                 // js stub
+            stubs.push_back({a.emit_rel32(), ip + 1, jit_exit::aborted});
+            break;
+        case opcode::write_value:
+            a.emit({0xbe}); a.emit32(o.value & 0xff);             // mov esi, value
+            a.emit({0x49, 0x8b, 0x7c, 0x24, 0x20});               // mov rdi, [r12+32]
+            a.emit({0x41, 0xff, 0x54, 0x24, 0x30});               // call [r12+48]
+            a.emit({0x85, 0xc0});                                 // test eax, eax
+            a.emit({0x0f, 0x88});                                 // js stub
+            stubs.push_back({a.emit_rel32(), ip + 1, jit_exit::aborted});
+            break;
+        case opcode::read:
+            a.emit({0x49, 0x8b, 0x7c, 0x24, 0x20});               // mov rdi, [r12+32]
+            a.emit({0x41, 0xff, 0x54, 0x24, 0x28});               // call [r12+40]
+            a.emit({0x85, 0xc0});                                 // test eax, eax
+            a.emit({0x0f, 0x88});                                 // js stub
+            stubs.push_back({a.emit_rel32(), ip, jit_exit::needs_input});
+            a.emit({0x88, 0x83}); a.emit32(o.offset);             // mov [rbx+offset], al
+            break;
+        case opcode::jump_zero:
+            a.emit({0x80, 0x3b, 0x00});                           // cmp byte [rbx], 0
+            a.emit({0x0f, 0x84});                                 // je target
+            jumps.emplace_back(a.emit_rel32(), o.target);
+            break;
+        case opcode::jump_not_zero:
+            // Back-edges are counted down, leave when reaching 0.
+            a.emit({0x80, 0x3b, 0x00});                           // cmp byte [rbx], 0
+            a.emit({0x74, 14});                                   // je next
+            a.emit({0x49, 0xff, 0xcf});                           // dec r15
+            a.emit({0x0f, 0x84});                                 // jz stub
+            stubs.push_back({a.emit_rel32(), o.target, jit_exit::countdown});
+            a.emit({0xe9});                                       // jmp target
+            jumps.emplace_back(a.emit_rel32(), o.target);
+            break;
+        case opcode::clear:
+            a.emit({0xc6, 0x83}); a.emit32(o.offset); a.emit({0x00}); // mov byte [rbx+offset], 0
+            break;
+        case opcode::multiply_add:
+            // Cells are not touched if the loop would not run at all.
+            a.emit({0x0f, 0xb6, 0x03});                           // movzx eax, byte [rbx]
+            a.emit({0x85, 0xc0});                                 // test eax, eax
+            a.emit({0x74, (unsigned char) (o.value == 1 ? 6 : 12)}); // jz next
+            if (o.value != 1) {
+                a.emit({0x69, 0xc0}); a.emit32(o.value);          // imul eax, eax, value
+            }
+            a.emit({0x00, 0x83}); a.emit32(o.offset);             // add [rbx+offset], al
+            break;
+        case opcode::product_add:
+            a.emit({0x0f, 0xb6, 0x03});                           // movzx eax, byte [rbx]
+            a.emit({0x0f, 0xb6, 0x8b}); a.emit32(o.source());     // movzx ecx, byte [rbx+source]
+            a.emit({0x0f, 0xaf, 0xc1});                           // imul eax, ecx
+            if (o.value != 1) {
+                a.emit({0x69, 0xc0}); a.emit32(o.value);          // imul eax, eax, value
+            }
+            a.emit({0x00, 0x83}); a.emit32(o.offset);             // add [rbx+offset], al
+            break;
+        case opcode::conditional_set:
+            a.emit({0x80, 0x3b, 0x00});                           // cmp byte [rbx], 0
+            a.emit({0x74, 7});                                    // je next
+            a.emit({0xc6, 0x83}); a.emit32(o.offset);             // mov byte [rbx+offset], value
+            a.emit({(unsigned char) o.value});
+            break;
+        case opcode::scan: {
+            const std::size_t loop = a.size();
+            a.emit({0x80, 0x3b, 0x00});                           // cmp byte [rbx], 0
+            a.emit({0x0f, 0x84});                                 // je done
+            const std::size_t done = a.emit_rel32();
+            a.emit({0x48, 0x81, 0xc3}); a.emit32(o.value);        // add rbx, value
+            emit_bounds_check(a, ip, stubs);                      // Continue scan after reserving
+            a.emit({0xe9}); a.patch_rel32(a.emit_rel32(), loop);  // jmp loop
+            a.patch_rel32(done, a.size());
+            emit_reach(a, reach_offsets[ip + 1]);
+            break;
+            }
+        }
+    }
+
+    // End of program
+    m_entry.push_back((std::uint32_t) a.size());
+    emit_exit(a, (std::uint32_t) code.size(), jit_exit::halted, epilogue);
+
+    for (const auto &stub : stubs) {
+        a.patch_rel32(stub.rel32, a.size());
+        emit_exit(a, stub.instruction_pointer, stub.reason, epilogue);
+    }
+    for (const auto &jump : jumps)
+        a.patch_rel32(jump.first, m_entry[jump.second]);
+
+    // Copy to executable memory
+    const std::size_t page = sysconf(_SC_PAGESIZE);
+    m_size = (a.size() + page - 1) / page * page;
+    void *memory = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::runtime_error("Could not map memory for JIT compilation!");
+    std::memcpy(memory, a.code().data(), a.size());
+    if (mprotect(memory, m_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, m_size);
+        throw std::runtime_error("Could not map memory for JIT compilation!");
+    }
+    m_code = static_cast<unsigned char*>(memory);
+#else
+    (void) code; (void) reach_offsets;
+    throw std::logic_error("JIT compilation is not supported on this platform!");
+#endif
+}
+
+jit_program::~jit_program() {
+#ifdef BF_JIT
+    munmap(m_code, m_size);
+#endif
+}
+
+jit_exit jit_program::run(jit_context &context, unsigned char *cell, std::size_t ip) const {
+#ifdef BF_JIT
+    using entry_t = int (*)(jit_context*, unsigned char*, const void*);
+    const auto entry = reinterpret_cast<entry_t>(m_code);
+    return static_cast<jit_exit>(entry(&context, cell, m_code + m_entry[ip]));
+#else
+    (void) context; (void) cell; (void) ip;
+    throw std::logic_error("JIT compilation is not supported on this platform!");
+#endif
+}
+
+} // namespace bf
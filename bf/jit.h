@@ -0,0 +1,68 @@
+/* "jit_program" translates bytecode to native x86-64 machine code (System V
+ * calling convention) for byte sized, wrapping cells. It is used by the
+ * 'jit' engine of "interpreter", which provides memory and I/O callbacks.
+ *
+ * The native code can be entered at the start of any bytecode instruction and
+ * leaves at instruction boundaries, too. Leaving is needed whenever the stack
+ * pointer moves outside of the reserved part of the tape, input is missing,
+ * the countdown of taken loop back-edges runs out or the program halts, so the
+ * interpreter can take over and resume afterwards.
+ * Callbacks must not throw, as exceptions cannot pass the native code.
+ */
+
+#pragma once
+
+#include "bytecode.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bf {
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define BF_JIT
+#endif
+
+// Layout is used by the generated code. Do not reorder!
+struct jit_context {
+    unsigned char *base;                             // Cell 0
+    std::size_t   reserved;                          // Number of cells usable without reserving
+    unsigned char *cell;                             // Current cell on exit
+    std::uint32_t instruction_pointer;               // Next instruction on exit
+    void          *user;                             // Passed to callbacks
+    int           (*read)(void *user);               // Next input or -1, if there is none
+    int           (*write)(void *user, unsigned char); // 0 or -1 to abort
+    std::uint64_t countdown;                         // Taken back-edges until leaving
+    std::size_t   max_cell;                          // Highest cell reached, updated after moves
+};
+
+enum class jit_exit : int {
+    halted      = 0, // End of program reached
+    reserve     = 1, // Stack pointer left reserved cells
+    needs_input = 2, // No input for a read instruction
+    aborted     = 3, // Write callback failed
+    countdown   = 4  // Countdown of taken back-edges reached 0
+};
+
+class jit_program {
+public:
+    // 'reach_offsets' of 'code' (see 'bf::reach_offsets') are added to the
+    // stack pointer after each move for 'jit_context::max_cell'. Throws
+    // std::logic_error if JIT compilation is not supported.
+    jit_program(code_view code, const std::vector<std::int32_t> &reach_offsets);
+    ~jit_program();
+
+    jit_program(const jit_program&) = delete;
+    jit_program &operator=(const jit_program&) = delete;
+
+    // Run native code starting at instruction 'ip' with current cell 'cell'.
+    jit_exit run(jit_context &context, unsigned char *cell, std::size_t ip) const;
+
+private:
+    unsigned char              *m_code;
+    std::size_t                m_size;
+    std::vector<std::uint32_t> m_entry; // Native offset per instruction
+};
+
+} // namespace bf
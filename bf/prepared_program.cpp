@@ -0,0 +1,245 @@
+#include "prepared_program.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bf {
+
+// File format (native byte order): 'file_header', the source padded to a
+// multiple of 8 bytes, all instructions as 'operation' and the source
+// position of each instruction. The version has to be increased whenever
+// the format, the instruction set or the lowering changes.
+static const char          file_magic[4] = {'B', 'F', 'B', 'C'};
+static const std::uint32_t file_version  = 1;
+
+struct file_header {
+    char          magic[4];
+    std::uint32_t version;
+    std::uint32_t cell_bits;
+    std::uint8_t  cell_signed;
+    std::uint8_t  cell_mode;
+    std::uint8_t  partial_evaluation;
+    std::uint8_t  operation_size; // Guards against other layouts of 'operation'
+    std::uint64_t source_size;
+    std::uint64_t code_size;      // Instructions
+    std::uint64_t hash;           // Of the bytecode
+    std::int32_t  min_offset;
+    std::int32_t  max_offset;
+};
+static_assert(sizeof(file_header) % 8 == 0, "Header must keep the source aligned!");
+
+static std::uint64_t padded(std::uint64_t size) {
+    return (size + 7) / 8 * 8;
+}
+
+// Lower 'program' and partially evaluate it, if requested.
+static bytecode prepare(const std::string &program, source_map &positions, const cell_type &cells,
+                        bool partial_evaluation) {
+    bytecode code = lower(program, &positions, cells);
+    if (partial_evaluation)
+        code = evaluate_prefix(code, &positions, cells);
+    return code;
+}
+
+prepared_program::prepared_program(const std::string &program, const cell_type &cells, bool partial_evaluation)
+    : m_source(program), m_cells(cells), m_partial_evaluation(partial_evaluation),
+      m_owned_code(prepare(program, m_owned_positions, cells, partial_evaluation)),
+      m_code(m_owned_code), m_positions(m_owned_positions), m_min_offset(bf::min_offset(m_owned_code)),
+      m_max_offset(bf::max_offset(m_owned_code)), m_max_move(bf::max_move(m_owned_code)),
+      m_reach_offsets(bf::reach_offsets(m_owned_code)), m_hash(bf::hash(m_owned_code)) {}
+
+void prepared_program::save(const std::string &path) const {
+    file_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version            = file_version;
+    header.cell_bits          = m_cells.bits;
+    header.cell_signed        = m_cells.is_signed;
+    header.cell_mode          = static_cast<std::uint8_t>(m_cells.mode);
+    header.partial_evaluation = m_partial_evaluation;
+    header.operation_size     = sizeof(operation);
+    header.source_size        = m_source.size();
+    header.code_size          = m_code.size();
+    header.hash               = m_hash;
+    header.min_offset         = m_min_offset;
+    header.max_offset         = m_max_offset;
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(m_source.data(), m_source.size());
+    const char padding[8] = {};
+    out.write(padding, padded(m_source.size()) - m_source.size());
+    for (const operation &o : m_code) {
+        operation record;
+        std::memset(&record, 0, sizeof(record)); // No random padding bytes
+        record.op     = o.op;
+        record.offset = o.offset;
+        record.value  = o.value;
+        record.target = o.target;
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    out.write(reinterpret_cast<const char*>(m_positions.data()), m_positions.size() * sizeof(std::uint32_t));
+    if (!out)
+        throw std::runtime_error("Could not write prepared program to '" + path + "'!");
+}
+
+// Contents of the file at 'path' and their owner, which keeps them alive.
+static std::shared_ptr<const void> read_file(const std::string &path, const char *&data, std::size_t &size) {
+#ifndef _WIN32
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not read prepared program from '" + path + "'!");
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        size = static_cast<std::size_t>(status.st_size);
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Could not read prepared program from '" + path + "'!");
+    data = static_cast<const char*>(mapping);
+    return std::shared_ptr<const void>(mapping, [size](const void *p) {munmap(const_cast<void*>(p), size);});
+#else
+    std::ifstream in(path, std::ios::binary);
+    auto contents = std::make_shared<std::vector<char>>(std::istreambuf_iterator<char>(in),
+                                                        std::istreambuf_iterator<char>());
+    if (!in && !in.eof())
+        throw std::runtime_error("Could not read prepared program from '" + path + "'!");
+    data = contents->data();
+    size = contents->size();
+    return contents;
+#endif
+}
+
+std::shared_ptr<const prepared_program> prepared_program::load(const std::string &path) {
+    const char *data = nullptr;
+    std::size_t size = 0;
+    std::shared_ptr<const void> file = read_file(path, data, size);
+    const auto invalid = [&path] {
+        return std::runtime_error("Invalid prepared program in '" + path + "'!");
+    };
+
+    file_header header;
+    if (size < sizeof(header))
+        throw invalid();
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0 || header.version != file_version
+            || header.operation_size != sizeof(operation) || header.cell_mode > static_cast<std::uint8_t>(overflow::trap))
+        throw invalid();
+    const std::uint64_t record_size = sizeof(operation) + sizeof(std::uint32_t);
+    if (header.source_size > size || header.code_size > size / record_size
+            || sizeof(header) + padded(header.source_size) + header.code_size * record_size != size)
+        throw invalid();
+
+    std::shared_ptr<prepared_program> result(new prepared_program());
+    const char *position = data + sizeof(header);
+    result->m_source.assign(position, header.source_size);
+    position += padded(header.source_size);
+    result->m_code = code_view(reinterpret_cast<const operation*>(position), header.code_size);
+    position += header.code_size * sizeof(operation);
+    result->m_positions = array_view<std::uint32_t>(reinterpret_cast<const std::uint32_t*>(position), header.code_size);
+
+    result->m_cells              = {header.cell_bits, header.cell_signed != 0, static_cast<overflow>(header.cell_mode)};
+    result->m_partial_evaluation = header.partial_evaluation != 0;
+    result->m_file               = std::move(file);
+    result->m_min_offset         = header.min_offset;
+    result->m_max_offset         = header.max_offset;
+    result->m_max_move           = bf::max_move(result->m_code);
+    result->m_hash               = header.hash;
+
+    // Jumps other than those between the two ends of a loop or offsets beyond
+    // the padding of the tape would let the interpreter run wild, scans
+    // without stride would never end. Positions out of the source would break
+    // reports and traces.
+    std::vector<std::size_t> loops; // Open jump_zero instructions
+    for (std::size_t ip = 0; ip < header.code_size; ++ip) {
+        const operation &o = result->m_code[ip];
+        if (o.op > opcode::write_value)
+            throw invalid();
+        if (o.op == opcode::jump_zero)
+            loops.push_back(ip);
+        else if (o.op == opcode::jump_not_zero) {
+            if (loops.empty() || o.target != loops.back() + 1 || result->m_code[loops.back()].target != ip + 1)
+                throw invalid();
+            loops.pop_back();
+        }
+        if ((o.op == opcode::scan && o.value == 0) || result->m_positions[ip] >= header.source_size)
+            throw invalid();
+    }
+    if (!loops.empty())
+        throw invalid();
+    if (bf::hash(result->m_code) != header.hash || bf::min_offset(result->m_code) != header.min_offset
+            || bf::max_offset(result->m_code) != header.max_offset)
+        throw invalid();
+    result->m_reach_offsets = bf::reach_offsets(result->m_code);
+    return result;
+}
+
+// FNV-1a of 'size' bytes at 'data', continuing 'result'
+static std::uint64_t hash_bytes(const void *data, std::size_t size, std::uint64_t result = 14695981039346656037ull) {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        result ^= bytes[i];
+        result *= 1099511628211ull;
+    }
+    return result;
+}
+
+std::shared_ptr<const prepared_program> prepared_program::cached(const std::string &directory,
+        const std::string &program, const cell_type &cells, bool partial_evaluation) {
+    const std::uint32_t options[] = {file_version, cells.bits, cells.is_signed,
+                                     static_cast<std::uint32_t>(cells.mode), partial_evaluation};
+    const std::uint64_t key = hash_bytes(program.data(), program.size(), hash_bytes(options, sizeof(options)));
+    std::ostringstream name;
+    name << directory << '/' << std::hex << std::setw(16) << std::setfill('0') << key << ".bfbc";
+    const std::string path = name.str();
+
+    // Missing or outdated files and hash collisions are prepared again.
+    if (std::ifstream(path)) {
+        try {
+            auto result = load(path);
+            if (result->source() == program && result->cells() == cells
+                    && result->partial_evaluation() == partial_evaluation)
+                return result;
+        } catch (const std::runtime_error&) {}
+    }
+
+    auto result = std::make_shared<const prepared_program>(program, cells, partial_evaluation);
+    // Other processes only ever see complete files. Failing to write the
+    // cache is no error, the program is just prepared again next time.
+    const std::string temporary = path + ".tmp" + std::to_string(std::random_device()());
+    try {
+        result->save(temporary);
+        if (std::rename(temporary.c_str(), path.c_str()) != 0)
+            std::remove(temporary.c_str());
+    } catch (const std::runtime_error&) {
+        std::remove(temporary.c_str());
+    }
+    return result;
+}
+
+const jit_program &prepared_program::jit() const {
+    std::call_once(m_jit_once, [this] {
+        if (m_cells.bits != 8 || m_cells.mode != overflow::wrap)
+            throw std::logic_error("JIT compilation requires 8 bit wrapping cells!");
+        m_jit.reset(new jit_program(m_code, m_reach_offsets));
+    });
+    return *m_jit;
+}
+
+} // namespace bf
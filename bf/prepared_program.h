@@ -0,0 +1,88 @@
+/* "prepared_program" holds a validated Brainfuck program, lowered to bytecode,
+ * together with everything derived from it (offsets, hash, source positions
+ * and native code). It is immutable after construction, so it can be shared by
+ * any number of interpreters, also across threads, to avoid lowering the same
+ * program for every run. Native code for the 'jit' engine is only compiled on
+ * first use.
+ *
+ * Prepared programs can be saved to a versioned binary file and loaded again
+ * without lowering. Loaded bytecode is mapped into memory and used in place,
+ * so short-lived processes can share a cache of prepared programs on disk.
+ */
+
+#pragma once
+
+#include "bytecode.h"
+#include "jit.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace bf {
+
+class prepared_program {
+public:
+    // Lowered for 'cells'. Throws std::logic_error on unbalanced brackets.
+    // With 'partial_evaluation', the input independent prefix of the program
+    // is executed once here (see 'evaluate_prefix'). Runs then start behind it,
+    // so its steps do not count against run limits and are not profiled.
+    explicit prepared_program(const std::string &program, const cell_type &cells = cell_type(),
+                              bool partial_evaluation = false);
+
+    prepared_program(const prepared_program&) = delete;
+    prepared_program &operator=(const prepared_program&) = delete;
+
+    // Save source, options, bytecode and source positions to 'path' (native
+    // byte order). Throws std::runtime_error if the file cannot be written.
+    void save(const std::string &path) const;
+
+    // Load a program saved by 'save'. Bytecode and source positions are
+    // mapped, not copied, where supported. Throws std::runtime_error if the
+    // file cannot be read or is no valid file of the current format version.
+    static std::shared_ptr<const prepared_program> load(const std::string &path);
+
+    // Load 'program' prepared with the same options from 'directory', if it
+    // has been saved there before. Else, prepare and save it there. Files are
+    // named by a hash of source and options.
+    static std::shared_ptr<const prepared_program> cached(const std::string &directory,
+            const std::string &program, const cell_type &cells = cell_type(), bool partial_evaluation = false);
+
+    const std::string &source() const {return m_source;}
+    const cell_type &cells() const {return m_cells;}
+    bool partial_evaluation() const {return m_partial_evaluation;}
+    code_view code() const {return m_code;}
+    array_view<std::uint32_t> positions() const {return m_positions;}
+    std::int32_t min_offset() const {return m_min_offset;}
+    std::int32_t max_offset() const {return m_max_offset;}
+    std::int64_t max_move() const {return m_max_move;}
+    const std::vector<std::int32_t> &reach_offsets() const {return m_reach_offsets;}
+    std::uint64_t hash() const {return m_hash;}
+
+    // Compiled on first call (thread-safe). Throws std::logic_error if JIT
+    // compilation is not supported.
+    const jit_program &jit() const;
+
+private:
+    prepared_program() = default;
+
+    std::string                          m_source;
+    cell_type                            m_cells;
+    bool                                 m_partial_evaluation = false;
+    source_map                           m_owned_positions; // Empty if loaded
+    bytecode                             m_owned_code;      // Empty if loaded
+    std::shared_ptr<const void>          m_file;            // Loaded file, if any
+    code_view                            m_code;
+    array_view<std::uint32_t>            m_positions;
+    std::int32_t                         m_min_offset = 0;
+    std::int32_t                         m_max_offset = 0;
+    std::int64_t                         m_max_move = 0;
+    std::vector<std::int32_t>            m_reach_offsets;
+    std::uint64_t                        m_hash = 0;
+    mutable std::once_flag               m_jit_once;
+    mutable std::unique_ptr<jit_program> m_jit;
+};
+
+} // namespace bf
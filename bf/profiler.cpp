@@ -0,0 +1,123 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <numeric>
+#include <sstream>
+
+namespace bf {
+
+loop_profiler::loop_profiler(const std::shared_ptr<const prepared_program> &program)
+    : m_program(program), m_executions(program->code().size()),
+      m_entries(program->code().size()), m_repeats(program->code().size()) {}
+
+std::uint64_t loop_profiler::instructions() const {
+    return std::accumulate(m_executions.begin(), m_executions.end(), std::uint64_t(0));
+}
+
+std::uint64_t loop_profiler::repeats() const {
+    return std::accumulate(m_repeats.begin(), m_repeats.end(), std::uint64_t(0));
+}
+
+std::vector<loop_profiler::loop> loop_profiler::loops() const {
+    const code_view code = m_program->code();
+    std::vector<loop> result;
+    for (std::size_t ip = 0; ip < code.size(); ++ip) {
+        if (code[ip].op != opcode::jump_zero || m_entries[ip] == 0)
+            continue;
+        const std::size_t end = code[ip].target - 1;
+        result.push_back({ip, end, m_program->positions()[ip], m_entries[ip],
+                          m_entries[ip] + m_repeats[ip],
+                          std::accumulate(m_executions.begin() + ip, m_executions.begin() + end + 1,
+                                          std::uint64_t(0))});
+    }
+    std::stable_sort(result.begin(), result.end(), [](const loop &a, const loop &b) {
+        return a.instructions > b.instructions;
+    });
+    return result;
+}
+
+std::vector<loop_profiler::block> loop_profiler::blocks() const {
+    // Blocks start at jump targets and behind jumps.
+    const code_view code = m_program->code();
+    std::vector<bool> leader(code.size() + 1, false);
+    leader[0] = true;
+    for (std::size_t ip = 0; ip < code.size(); ++ip) {
+        if (code[ip].op == opcode::jump_zero || code[ip].op == opcode::jump_not_zero) {
+            leader[ip + 1] = true;
+            leader[code[ip].target] = true;
+        }
+    }
+
+    std::vector<block> result;
+    for (std::size_t begin = 0; begin < code.size();) {
+        std::size_t end = begin + 1;
+        while (end < code.size() && !leader[end])
+            ++end;
+        result.push_back({begin, end, m_executions[begin],
+                          std::accumulate(m_executions.begin() + begin, m_executions.begin() + end,
+                                          std::uint64_t(0))});
+        begin = end;
+    }
+    return result;
+}
+
+std::vector<std::pair<std::string, std::uint64_t>>
+loop_profiler::aggregate(const std::function<std::string(std::uint32_t position)> &key) const {
+    std::map<std::string, std::uint64_t> sums;
+    for (std::size_t ip = 0; ip < m_executions.size(); ++ip) {
+        if (m_executions[ip] != 0)
+            sums[key(m_program->positions()[ip])] += m_executions[ip];
+    }
+
+    std::vector<std::pair<std::string, std::uint64_t>> result(sums.begin(), sums.end());
+    std::stable_sort(result.begin(), result.end(),
+        [](const std::pair<std::string, std::uint64_t> &a, const std::pair<std::string, std::uint64_t> &b) {
+            return a.second > b.second;
+        });
+    return result;
+}
+
+std::string loop_profiler::report(std::size_t max_loops) const {
+    const std::uint64_t total = instructions();
+    const std::string &source = m_program->source();
+
+    std::ostringstream out;
+    out << "Executed instructions: " << total << '\n';
+    out << std::setw(10) << "Position" << std::setw(12) << "Entries" << std::setw(14) << "Iterations"
+        << std::setw(16) << "Instructions" << std::setw(9) << "Share" << "  Code\n";
+
+    const auto hot_loops = loops();
+    for (std::size_t i = 0; i < hot_loops.size() && i < max_loops; ++i) {
+        const loop &l = hot_loops[i];
+
+        // Brainfuck operations of the loop, starting at '['
+        std::string snippet;
+        for (std::size_t pos = l.source_position; pos < source.size() && snippet.size() < 40; ++pos) {
+            if (std::string("+-<>[],.").find(source[pos]) != std::string::npos)
+                snippet += source[pos];
+        }
+        if (snippet.size() == 40)
+            snippet += "...";
+
+        out << std::setw(10) << l.source_position << std::setw(12) << l.entries
+            << std::setw(14) << l.iterations << std::setw(16) << l.instructions
+            << std::setw(8) << std::fixed << std::setprecision(1)
+            << (total ? 100.0 * l.instructions / total : 0.0) << "%  " << snippet << '\n';
+    }
+    return out.str();
+}
+
+void step_counter::reset() {
+    std::fill(m_executions.begin(), m_executions.end(), 0);
+    m_repeats = 0;
+}
+
+void loop_profiler::reset() {
+    std::fill(m_executions.begin(), m_executions.end(), 0);
+    std::fill(m_entries.begin(), m_entries.end(), 0);
+    std::fill(m_repeats.begin(), m_repeats.end(), 0);
+}
+
+} // namespace bf
@@ -0,0 +1,122 @@
+/* Profiling policies for "interpreter". The interpreter calls the hooks of its
+ * profiler for each executed instruction, each entered loop and each repeated
+ * loop. "no_profiler" is the default and has empty hooks, so profiling is
+ * compiled out completely. "step_counter" only counts executions per
+ * instruction and repeated loops, as needed for the instruction counts of
+ * 'interpreter::statistics'. "loop_profiler" counts executions per instruction
+ * and per loop ('[' site) and summarizes them per loop and per basic block.
+ *
+ * Profiling is not supported by the 'jit' engine.
+ */
+
+#pragma once
+
+#include "prepared_program.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bf {
+
+class no_profiler {
+public:
+    static const bool enabled = false;
+
+    explicit no_profiler(const std::shared_ptr<const prepared_program>&) {}
+
+    void instruction(std::size_t) {}
+    void loop_entry(std::size_t) {}
+    void loop_repeat(std::size_t) {}
+};
+
+class step_counter {
+public:
+    static const bool enabled = true;
+
+    explicit step_counter(const std::shared_ptr<const prepared_program> &program)
+        : m_executions(program->code().size()), m_repeats(0) {}
+
+    void instruction(std::size_t ip) {++m_executions[ip];}
+    void loop_entry(std::size_t) {}
+    void loop_repeat(std::size_t) {++m_repeats;}
+
+    // Executions per instruction index
+    const std::vector<std::uint64_t> &executions() const {return m_executions;}
+
+    // Back-edges taken by all loops
+    std::uint64_t repeats() const {return m_repeats;}
+
+    void reset();
+
+private:
+    std::vector<std::uint64_t> m_executions;
+    std::uint64_t              m_repeats;
+};
+
+class loop_profiler {
+public:
+    static const bool enabled = true;
+
+    struct loop {
+        std::size_t   begin;           // Instruction index of 'jump_zero'
+        std::size_t   end;             // Instruction index of 'jump_not_zero'
+        std::uint32_t source_position; // Of '['
+        std::uint64_t entries;         // Times the loop was entered (not skipped)
+        std::uint64_t iterations;      // Times the loop body was run ('entries' plus back-edges taken)
+        std::uint64_t instructions;    // Executed instructions, including nested loops
+    };
+
+    struct block {
+        std::size_t   begin;           // First instruction index
+        std::size_t   end;             // Behind last instruction index
+        std::uint64_t executions;
+        std::uint64_t instructions;
+    };
+
+    explicit loop_profiler(const std::shared_ptr<const prepared_program> &program);
+
+    // Hooks with instruction index 'ip'. Loops are identified by 'jump_zero'.
+    void instruction(std::size_t ip) {++m_executions[ip];}
+    void loop_entry(std::size_t ip) {++m_entries[ip];}
+    void loop_repeat(std::size_t ip) {++m_repeats[ip];}
+
+    const std::shared_ptr<const prepared_program> &program() const {return m_program;}
+
+    // Executions per instruction index
+    const std::vector<std::uint64_t> &executions() const {return m_executions;}
+    std::uint64_t instructions() const;
+
+    // Back-edges taken by all loops. Unlike the sum of 'loop::iterations', the
+    // first run of a body per entry is not counted.
+    std::uint64_t repeats() const;
+
+    // All loops which were entered, hottest (most executed instructions) first.
+    std::vector<loop> loops() const;
+
+    // All basic blocks in program order.
+    std::vector<block> blocks() const;
+
+    // Executed instructions summed up by the 'key' of their source position
+    // (e.g. the originating function, see "code_map"), most executed first.
+    std::vector<std::pair<std::string, std::uint64_t>>
+    aggregate(const std::function<std::string(std::uint32_t position)> &key) const;
+
+    // Human readable report of the 'max_loops' hottest loops with their source
+    // position and code.
+    std::string report(std::size_t max_loops = 10) const;
+
+    void reset();
+
+private:
+    std::shared_ptr<const prepared_program> m_program;
+    std::vector<std::uint64_t>              m_executions;
+    std::vector<std::uint64_t>              m_entries;
+    std::vector<std::uint64_t>              m_repeats;
+};
+
+} // namespace bf
@@ -0,0 +1,405 @@
+/* Memory models ("tapes") for "interpreter". The interpreter accesses cells
+ * without any bounds checks and only calls 'reserve' whenever the stack pointer
+ * has been moved. Each tape has to ensure that all cells in reach of the stack
+ * pointer, given by the lowest and highest offset used in the bytecode, can be
+ * accessed afterwards. Tapes are constructed with both offsets and the largest
+ * move of the bytecode (see 'max_move'). Cells below zero, which are only
+ * reached by a negative offset, are padding: 'accessible' reports them as out
+ * of bounds for the interpreter's bounds checks.
+ *
+ * "vector_tape" grows on demand and is used by default. "guarded_tape" maps a
+ * large, lazily zero-filled region with guard pages on both ends instead, so
+ * 'reserve' is a no-op and running out of memory is caught by a signal handler
+ * and turned into an exception. Both store all cells contiguously, which
+ * allows to scan with memchr and to run native code.
+ *
+ * "paged_tape" splits the cells into fixed-size pages, which are allocated
+ * on first touch. Memory is proportional to the pages actually used, so
+ * programs using the tape as a sparse heap (e.g. touching cell 10,000,000
+ * only) stay small. The page of the last access is cached.
+ */
+
+#pragma once
+
+#include "scope_exit.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <csetjmp>
+#include <csignal>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace bf {
+
+namespace detail {
+    // Drop the padding for offsets from 'cells', i.e. trailing zero cells
+    // behind the first 'reached' ones.
+    template <typename memory_type>
+    void trim_padding(std::vector<memory_type> &cells, std::size_t reached) {
+        while (cells.size() > reached && cells.back() == 0)
+            cells.pop_back();
+    }
+} // namespace detail
+
+template <typename memory_type>
+class vector_tape {
+public:
+    static const bool contiguous = true;
+
+    // Cells below zero (reached by a negative offset) are backed by padding.
+    vector_tape(std::int32_t min_offset, std::int32_t max_offset, std::int64_t /*max_move*/)
+        : m_cells(-min_offset), m_front(-min_offset), m_back(max_offset), m_size(0) {}
+
+    memory_type &operator[](std::size_t position) {
+        return m_cells[m_front + position];
+    }
+
+    // Whether cell 'position' is reserved. Cells below zero (wrapped) are not,
+    // even if backed by padding.
+    bool accessible(std::size_t position) const {
+        return position < m_size;
+    }
+
+    void reserve(std::size_t position) {
+        if (position + m_back >= m_size || static_cast<std::ptrdiff_t>(position) < 0) {
+            if (static_cast<std::ptrdiff_t>(position) < 0)
+                throw std::runtime_error("Stack pointer moved below zero!");
+            m_size = position + m_back + 1;
+            m_cells.resize(m_front + m_size);
+        }
+    }
+
+    // Accessible cells starting at cell 0. All cells behind are 0.
+    memory_type *data() {return m_cells.data() + m_front;}
+    const memory_type *data() const {return m_cells.data() + m_front;}
+    std::size_t size() const {return m_size;}
+
+    // Positions below do not need to be reserved.
+    std::size_t reserved() const {return m_size - m_back;}
+
+    // Stack pointers from here on cannot be reserved.
+    std::size_t capacity() const {return m_cells.max_size() - m_front - m_back;}
+
+    // Cells up to the highest one reached by the stack pointer, and all
+    // cells behind which are not 0.
+    const std::vector<memory_type> &contents() const {
+        m_contents.assign(data(), data() + size());
+        detail::trim_padding(m_contents, m_size > m_back ? m_size - m_back : 0);
+        return m_contents;
+    }
+
+    // Replace all cells by 'count' cells from 'cells'. The stack pointer has
+    // to be reserved again afterwards.
+    void load(const memory_type *cells, std::size_t count) {
+        m_cells.assign(m_front, 0);
+        m_cells.insert(m_cells.end(), cells, cells + count);
+        m_size = count;
+    }
+
+    template <typename function, typename fault_function>
+    auto guard(function &&f, fault_function&&) -> decltype(f()) {
+        return f();
+    }
+
+private:
+    std::vector<memory_type>         m_cells;
+    const std::size_t                m_front;
+    const std::size_t                m_back;
+    std::size_t                      m_size;
+    mutable std::vector<memory_type> m_contents;
+};
+
+template <typename memory_type, unsigned page_bits = 12>
+class paged_tape {
+public:
+    static const bool        contiguous = false;
+    static const std::size_t page_size  = std::size_t(1) << page_bits; // Cells
+
+    // Cells below zero (reached by a negative offset) are backed by padding.
+    paged_tape(std::int32_t min_offset, std::int32_t max_offset, std::int64_t /*max_move*/)
+        : m_front(-min_offset), m_back(max_offset), m_high(0),
+          m_cached_page(static_cast<std::size_t>(-1)), m_cached(nullptr) {}
+
+    memory_type &operator[](std::size_t position) {
+        const std::size_t index = m_front + position;
+        if (index >> page_bits != m_cached_page)
+            cache(index >> page_bits);
+        return m_cached[index & (page_size - 1)];
+    }
+
+    // Whether cell 'position' may be accessed. Cells below zero (wrapped) may
+    // not, even if backed by padding. Pages behind are allocated on access.
+    bool accessible(std::size_t position) const {
+        return static_cast<std::ptrdiff_t>(position) >= 0;
+    }
+
+    // Pages are allocated on access, so only the stack pointer is checked.
+    void reserve(std::size_t position) {
+        if (static_cast<std::ptrdiff_t>(position) < 0)
+            throw std::runtime_error("Stack pointer moved below zero!");
+        m_high = std::max(m_high, position);
+    }
+
+    // Stack pointers from here on cannot be reserved.
+    std::size_t capacity() const {
+        return static_cast<std::size_t>(std::numeric_limits<std::ptrdiff_t>::max()) - m_front - m_back;
+    }
+
+    // Number of allocated pages
+    std::size_t pages() const {
+        return std::count_if(m_pages.begin(), m_pages.end(),
+                             [](const std::unique_ptr<memory_type[]> &page) {return page != nullptr;});
+    }
+
+    // Cells up to the highest one reached by the stack pointer, and all
+    // cells behind which are not 0.
+    const std::vector<memory_type> &contents() const {
+        m_contents.assign(m_high + m_back + 1, 0);
+        for (std::size_t page = 0; page < m_pages.size(); ++page) {
+            if (!m_pages[page])
+                continue;
+            for (std::size_t i = 0; i < page_size; ++i) {
+                const std::size_t position = (page << page_bits) + i - m_front;
+                if (position < m_contents.size())
+                    m_contents[position] = m_pages[page][i];
+            }
+        }
+        detail::trim_padding(m_contents, m_high + 1);
+        return m_contents;
+    }
+
+    // Replace all cells by 'count' cells from 'cells'. Pages are only
+    // allocated for cells which are not 0. The stack pointer has to be
+    // reserved again afterwards.
+    void load(const memory_type *cells, std::size_t count) {
+        m_pages.clear();
+        m_cached_page = static_cast<std::size_t>(-1);
+        for (std::size_t position = 0; position < count; ++position)
+            if (cells[position] != 0)
+                (*this)[position] = cells[position];
+        m_high = count > m_back + 1 ? count - m_back - 1 : 0;
+    }
+
+    template <typename function, typename fault_function>
+    auto guard(function &&f, fault_function&&) -> decltype(f()) {
+        return f();
+    }
+
+private:
+    // Make 'page' the cached page, allocating it if untouched so far.
+    void cache(std::size_t page) {
+        if (page >= m_pages.size())
+            m_pages.resize(page + 1);
+        if (!m_pages[page])
+            m_pages[page].reset(new memory_type[page_size]());
+        m_cached_page = page;
+        m_cached      = m_pages[page].get();
+    }
+
+    std::vector<std::unique_ptr<memory_type[]>> m_pages;
+    const std::size_t                m_front;
+    const std::size_t                m_back;
+    std::size_t                      m_high;
+    std::size_t                      m_cached_page;
+    memory_type                      *m_cached;
+    mutable std::vector<memory_type> m_contents;
+};
+
+#ifndef _WIN32
+namespace detail {
+    // Guarded regions of the running guarded_tape (per thread).
+    struct fault_guard {
+        sigjmp_buf  env;
+        const char *front_guard;
+        const char *back_guard;
+        std::size_t guard_size;
+        fault_guard *previous;
+    };
+
+    inline fault_guard *&current_fault_guard() {
+        static thread_local fault_guard *guard = nullptr;
+        return guard;
+    }
+
+    // Handlers which were installed before 'fault_handler'
+    inline struct sigaction *previous_fault_actions() {
+        static struct sigaction actions[2]; // SIGSEGV, SIGBUS
+        return actions;
+    }
+
+    inline void fault_handler(int signal, siginfo_t *info, void *context) {
+        const char *address = static_cast<const char*>(info->si_addr);
+        for (fault_guard *g = current_fault_guard(); g != nullptr; g = g->previous) {
+            if ((address >= g->front_guard && address < g->front_guard + g->guard_size) ||
+                (address >= g->back_guard  && address < g->back_guard  + g->guard_size))
+                siglongjmp(g->env, 1);
+        }
+
+        // Not ours: Pass it on to the previous handler. Without one, restore
+        // the default action, so the fault terminates the process when the
+        // faulting instruction is run again.
+        const struct sigaction &previous = previous_fault_actions()[signal == SIGSEGV ? 0 : 1];
+        if (previous.sa_flags & SA_SIGINFO)
+            previous.sa_sigaction(signal, info, context);
+        else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+            previous.sa_handler(signal);
+        else {
+            struct sigaction action = {};
+            action.sa_handler = SIG_DFL;
+            sigemptyset(&action.sa_mask);
+            sigaction(signal, &action, nullptr);
+        }
+    }
+
+    // Install 'fault_handler' before the first guarded_tape runs. It is never
+    // removed, as other threads may run guarded tapes at any time. Handlers
+    // installed later have to pass faults they do not handle on to it.
+    inline void install_fault_handler() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            for (const int signal : {SIGSEGV, SIGBUS}) {
+                struct sigaction action = {};
+                action.sa_sigaction = fault_handler;
+                action.sa_flags = SA_SIGINFO;
+                sigemptyset(&action.sa_mask);
+                sigaction(signal, &action, &previous_fault_actions()[signal == SIGSEGV ? 0 : 1]);
+            }
+        });
+    }
+} // namespace detail
+
+template <typename memory_type>
+class guarded_tape {
+public:
+    static const bool contiguous = true;
+    static const std::size_t default_size = std::size_t(1) << 28; // Cells
+    static const std::size_t guard_size   = std::size_t(1) << 24; // Bytes
+
+    // Between two cell accesses, the stack pointer moves at most 'max_move'
+    // cells and the offsets differ by at most 'max_offset - min_offset'. If
+    // an access is out of bounds, it is at most the sum of both away from the
+    // last valid one. It only hits a guard page (and not any other mapped
+    // memory behind) if the sum is below 'guard_size' bytes, i.e. 16 MiB.
+    // Throws std::logic_error for bytecode exceeding it.
+    guarded_tape(std::int32_t min_offset, std::int32_t max_offset, std::int64_t max_move,
+                 std::size_t size = default_size)
+        : m_back(max_offset), m_high(0)
+    {
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        m_bytes = (size * sizeof(memory_type) + page - 1) / page * page;
+        const std::uint64_t reach = static_cast<std::uint64_t>(max_move)
+                                  + static_cast<std::uint64_t>(static_cast<std::int64_t>(max_offset) - min_offset);
+        if (reach >= guard_size / sizeof(memory_type))
+            throw std::logic_error("Moves and offsets exceed guard size of tape!");
+
+        void *region = mmap(nullptr, m_bytes + 2 * guard_size, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED)
+            throw std::runtime_error("Could not map memory for tape!");
+        m_region = static_cast<char*>(region);
+        if (mprotect(m_region + guard_size, m_bytes, PROT_READ | PROT_WRITE) != 0) {
+            munmap(m_region, m_bytes + 2 * guard_size);
+            throw std::runtime_error("Could not map memory for tape!");
+        }
+        m_cells = reinterpret_cast<memory_type*>(m_region + guard_size);
+    }
+
+    ~guarded_tape() {
+        munmap(m_region, m_bytes + 2 * guard_size);
+    }
+
+    guarded_tape(const guarded_tape&) = delete;
+    guarded_tape &operator=(const guarded_tape&) = delete;
+
+    memory_type &operator[](std::size_t position) {
+        return m_cells[position];
+    }
+
+    // Whether cell 'position' is mapped (not below zero, if wrapped)
+    bool accessible(std::size_t position) const {
+        return position < size();
+    }
+
+    // Only remember the highest stack pointer for 'contents'.
+    void reserve(std::size_t position) {
+        if (static_cast<std::ptrdiff_t>(position) < 0)
+            throw std::runtime_error("Stack pointer moved below zero!");
+        m_high = std::max<std::ptrdiff_t>(m_high, position);
+    }
+
+    memory_type *data() {return m_cells;}
+    const memory_type *data() const {return m_cells;}
+    std::size_t size() const {return m_bytes / sizeof(memory_type);}
+
+    // Positions below do not need to be reserved.
+    std::size_t reserved() const {return m_high + 1;}
+
+    // Stack pointers from here on are out of memory bounds.
+    std::size_t capacity() const {return size();}
+
+    // Cells up to the highest one reached by the stack pointer, and all
+    // cells behind which are not 0.
+    const std::vector<memory_type> &contents() const {
+        m_contents.assign(m_cells, m_cells + used());
+        detail::trim_padding(m_contents, m_high + 1);
+        return m_contents;
+    }
+
+    // Replace all cells by 'count' cells from 'cells'. The stack pointer has
+    // to be reserved again afterwards.
+    void load(const memory_type *cells, std::size_t count) {
+        if (count > size())
+            throw std::runtime_error("Stack pointer out of memory bounds!");
+        std::fill(m_cells + count, m_cells + std::max(count, used()), 0);
+        std::copy(cells, cells + count, m_cells);
+        m_high = count > m_back + 1 ? count - m_back - 1 : 0;
+    }
+
+    // Run 'f' and turn accesses to the guard pages into an exception. The
+    // fault handler jumps right back here, so 'f' must not leave any object
+    // with a destructor behind, when accessing cells. Whatever 'f' did not
+    // write back is lost, 'on_fault' has to deal with that.
+    template <typename function, typename fault_function>
+    auto guard(function &&f, fault_function &&on_fault) -> decltype(f()) {
+        detail::fault_guard g;
+        g.front_guard = m_region;
+        g.back_guard  = m_region + guard_size + m_bytes;
+        g.guard_size  = guard_size;
+        g.previous    = detail::current_fault_guard();
+
+        detail::install_fault_handler();
+        SCOPE_EXIT {detail::current_fault_guard() = g.previous;};
+        if (sigsetjmp(g.env, 1) != 0) {
+            on_fault();
+            throw std::runtime_error("Stack pointer out of memory bounds!");
+        }
+        detail::current_fault_guard() = &g;
+        return f();
+    }
+
+private:
+    // Cells which may have been written
+    std::size_t used() const {
+        return std::min<std::size_t>(m_high + m_back + 1, size());
+    }
+
+    char                             *m_region;
+    std::size_t                      m_bytes;
+    memory_type                      *m_cells;
+    const std::size_t                m_back;
+    std::ptrdiff_t                   m_high;
+    mutable std::vector<memory_type> m_contents;
+};
+#endif
+
+} // namespace bf
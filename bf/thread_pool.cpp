@@ -0,0 +1,82 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace bf {
+
+thread_pool::thread_pool(unsigned threads) : m_queued(0), m_stop(false) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned w = 0; w < threads; ++w)
+        m_queues.emplace_back(new worker_queue);
+    for (unsigned w = 0; w < threads; ++w)
+        m_workers.emplace_back(&thread_pool::work, this, w);
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    for (auto &worker : m_workers)
+        worker.join();
+}
+
+void thread_pool::push(unsigned worker, std::vector<std::function<void()>> tasks) {
+    if (tasks.empty())
+        return;
+    {
+        // Counted under 'm_mutex', so no worker misses the wakeup, and before
+        // queueing, so the counter never drops below 0.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued += tasks.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_queues[worker]->mutex);
+        for (auto &task : tasks)
+            m_queues[worker]->tasks.push_back(std::move(task));
+    }
+    m_wakeup.notify_all();
+}
+
+bool thread_pool::pop(unsigned worker, std::function<void()> &task) {
+    std::lock_guard<std::mutex> lock(m_queues[worker]->mutex);
+    auto &tasks = m_queues[worker]->tasks;
+    if (tasks.empty())
+        return false;
+    task = std::move(tasks.front());
+    tasks.pop_front();
+    --m_queued;
+    return true;
+}
+
+bool thread_pool::steal(unsigned worker, std::function<void()> &task) {
+    for (std::size_t i = 1; i < m_queues.size(); ++i) {
+        worker_queue &victim = *m_queues[(worker + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            --m_queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::work(unsigned worker) {
+    for (;;) {
+        std::function<void()> task;
+        if (pop(worker, task) || steal(worker, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wakeup.wait(lock, [this] {return m_stop || m_queued > 0;});
+        if (m_stop && m_queued == 0)
+            return;
+    }
+}
+
+} // namespace bf
@@ -0,0 +1,89 @@
+/* "thread_pool" runs tasks on a fixed set of worker threads. Each worker owns
+ * a queue: It takes tasks from the front of its own queue and, once that is
+ * empty, steals tasks from the back of the other queues. 'parallel_for' hands
+ * out contiguous ranges of indices per worker, so workers mostly run on their
+ * own queue and only uneven run times lead to stealing.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bf {
+
+class thread_pool {
+public:
+    // Use one thread per hardware thread, if 'threads' is 0.
+    explicit thread_pool(unsigned threads = 0);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool &operator=(const thread_pool&) = delete;
+
+    unsigned size() const {return static_cast<unsigned>(m_workers.size());}
+
+    // Run 'task(i)' for all i in [0, count) and wait until all are done. The
+    // first exception thrown by a task is rethrown afterwards.
+    template <typename function>
+    void parallel_for(std::size_t count, function &&task) {
+        struct batch_state {
+            std::mutex              mutex;
+            std::condition_variable done;
+            std::size_t             remaining;
+            std::exception_ptr      error;
+        } state;
+        state.remaining = count;
+
+        std::vector<std::vector<std::function<void()>>> queues(size());
+        for (std::size_t i = 0; i < count; ++i) {
+            queues[i * size() / count].push_back([&state, &task, i] {
+                try {
+                    task(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    if (!state.error)
+                        state.error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (--state.remaining == 0)
+                    state.done.notify_all();
+            });
+        }
+        for (unsigned w = 0; w < size(); ++w)
+            push(w, std::move(queues[w]));
+
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.done.wait(lock, [&state] {return state.remaining == 0;});
+        if (state.error)
+            std::rethrow_exception(state.error);
+    }
+
+private:
+    struct worker_queue {
+        std::mutex                        mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void push(unsigned worker, std::vector<std::function<void()>> tasks);
+    bool pop(unsigned worker, std::function<void()> &task);
+    bool steal(unsigned worker, std::function<void()> &task);
+    void work(unsigned worker);
+
+    std::vector<std::unique_ptr<worker_queue>> m_queues;
+    std::vector<std::thread>                   m_workers;
+    std::mutex                                 m_mutex;   // For sleeping workers
+    std::condition_variable                    m_wakeup;
+    std::atomic<std::size_t>                   m_queued;  // Tasks in all queues
+    bool                                       m_stop;
+};
+
+} // namespace bf
@@ -0,0 +1,63 @@
+/* I/O tracing policies for "interpreter". The interpreter calls the hooks of
+ * its tracer for each cell read from the input and each cell written to the
+ * output. "no_tracer" is the default and has empty hooks, so tracing is
+ * compiled out completely. "io_tracer" records every transfer together with
+ * the instruction and source position which caused it.
+ *
+ * Tracing is not supported by the 'jit' engine.
+ */
+
+#pragma once
+
+#include "prepared_program.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bf {
+
+class no_tracer {
+public:
+    static const bool enabled = false;
+
+    explicit no_tracer(const std::shared_ptr<const prepared_program>&) {}
+
+    void input(std::size_t, std::uint64_t) {}
+    void output(std::size_t, std::uint64_t) {}
+};
+
+class io_tracer {
+public:
+    static const bool enabled = true;
+
+    struct event {
+        bool          is_output;
+        std::size_t   instruction;     // Instruction index
+        std::uint32_t source_position;
+        std::uint64_t value;           // Cell value, converted
+    };
+
+    explicit io_tracer(const std::shared_ptr<const prepared_program> &program)
+        : m_program(program) {}
+
+    // Hooks with instruction index 'ip'
+    void input(std::size_t ip, std::uint64_t value) {record(false, ip, value);}
+    void output(std::size_t ip, std::uint64_t value) {record(true, ip, value);}
+
+    // All transfers in the order they happened
+    const std::vector<event> &events() const {return m_events;}
+
+    void reset() {m_events.clear();}
+
+private:
+    void record(bool is_output, std::size_t ip, std::uint64_t value) {
+        m_events.push_back({is_output, ip, m_program->positions()[ip], value});
+    }
+
+    std::shared_ptr<const prepared_program> m_program;
+    std::vector<event>                      m_events;
+};
+
+} // namespace bf
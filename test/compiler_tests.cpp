@@ -7,25 +7,59 @@
 #include "../bf/compiler.h"
 #include "../bf/interpreter.h"
 
+// A compiled program, prepared without and with partial evaluation. Tests
+// checking it for several inputs prepare it once and pass it to each check.
 template <typename memory_type = unsigned char>
-void bfc_check(const std::string &program, const std::string &description,
-        const std::vector<memory_type> &input, const std::vector<memory_type> &expected_output)
+struct checked_program {
+    std::shared_ptr<const bf::prepared_program> modes[2];
+
+    checked_program(const std::string &program) {
+        for (const bool partial_evaluation : {false, true})
+            modes[partial_evaluation] = std::make_shared<const bf::prepared_program>(
+                program, bf::interpreter<memory_type>::cells(), partial_evaluation);
+    }
+};
+
+template <typename memory_type = unsigned char>
+void bfc_check(const checked_program<memory_type> &program, const std::string &description,
+        const std::vector<memory_type> &input, const std::vector<memory_type> &expected_output,
+        std::uint64_t max_instructions = 0)
 {
-    bf::interpreter<memory_type> test(program);
-    test.send_input(input);
-    test.run();
-    const auto received_output = test.recv_output();
-
-    BOOST_CHECK_MESSAGE(std::equal(expected_output.begin(), expected_output.end(),
-                                   received_output.begin(), received_output.end()),
-                        "Unexpected result after processing '" + description + "'!");
-
-    BOOST_TEST_MESSAGE("----- Results for '" + description + "' -----");
-    std::string output_int;
-    for (auto v : received_output)
-        output_int += " " + std::to_string(v);
-    BOOST_TEST_MESSAGE("Received output (as int):" + output_int);
-    BOOST_TEST_MESSAGE("Memory used: " + std::to_string(test.get_memory().size()));
+    // Run on all engines, with and without partial evaluation
+    for (const auto &prepared : program.modes) {
+        for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+            if (!bf::interpreter<memory_type>::supports(engine))
+                continue;
+            bf::interpreter<memory_type> test(prepared, engine);
+            test.send_input(input);
+            BOOST_CHECK_MESSAGE(test.run() == bf::run_status::halted,
+                                "Missing input after processing '" + description + "'!");
+            const auto received_output = test.recv_output();
+
+            BOOST_CHECK_MESSAGE(std::equal(expected_output.begin(), expected_output.end(),
+                                           received_output.begin(), received_output.end()),
+                                "Unexpected result after processing '" + description + "'!");
+
+            BOOST_TEST_MESSAGE("----- Results for '" + description + "' -----");
+            std::string output_int;
+            for (auto v : received_output)
+                output_int += " " + std::to_string(v);
+            BOOST_TEST_MESSAGE("Received output (as int):" + output_int);
+            BOOST_TEST_MESSAGE("Memory used: " + std::to_string(test.get_memory().size()));
+        }
+    }
+
+    // Executed instructions, to catch generated code getting slower. Only
+    // checked against 'max_instructions' if given.
+    bf::interpreter<memory_type, bf::vector_tape<memory_type>, bf::step_counter> counted(program.modes[false]);
+    counted.send_input(input);
+    counted.run();
+    const bf::run_statistics statistics = counted.statistics();
+    BOOST_TEST_MESSAGE("Executed instructions: " + std::to_string(statistics.instructions)
+                       + " (" + std::to_string(statistics.commands) + " commands)");
+    BOOST_CHECK_MESSAGE(max_instructions == 0 || statistics.instructions <= max_instructions,
+                        "Executed " + std::to_string(statistics.instructions) + " instructions for '"
+                        + description + "', expected at most " + std::to_string(max_instructions) + "!");
 }
 
 // ----- Example program: Hello world ------------------------------------------
@@ -37,10 +71,10 @@ BOOST_AUTO_TEST_CASE(example_hello_world) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result = "Hello world";
 
-    bfc_check(program, "Hello world", {}, {result.begin(), result.end()});
+    bfc_check(program, "Hello world", {}, {result.begin(), result.end()}, 100);
 }
 
 // ----- Example program: Min/Max ----------------------------------------------
@@ -63,7 +97,7 @@ BOOST_AUTO_TEST_CASE(example_min_max) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Min/Max", {2, 5}, {2, 5});
     bfc_check(program, "Min/Max", {7, 3}, {3, 7});
@@ -82,7 +116,7 @@ BOOST_AUTO_TEST_CASE(compiler_function_call) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result = "test";
 
     bfc_check(program, "Function call 'test()'", {}, {result.begin(), result.end()});
@@ -102,7 +136,7 @@ BOOST_AUTO_TEST_CASE(compiler_function_arguments) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Echo", {2}, {2});
     bfc_check(program, "Echo", {6}, {6});
@@ -122,7 +156,7 @@ BOOST_AUTO_TEST_CASE(compiler_function_return_value) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Function return value", {}, {5, 0});
 }
@@ -139,7 +173,7 @@ BOOST_AUTO_TEST_CASE(compiler_scan_and_print) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Echo, plus two", {2},  {2,  4});
     bfc_check(program, "Echo, plus two", {5},  {5,  7});
@@ -158,7 +192,7 @@ BOOST_AUTO_TEST_CASE(compiler_scan_and_print_2) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Echo, plus 'a'", {2},  {2,  'c'});
     bfc_check(program, "Echo, plus 'a'", {5},  {5,  'f'});
@@ -178,7 +212,7 @@ BOOST_AUTO_TEST_CASE(compiler_arithmetics) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Arithmetics", {}, {19});
 }
@@ -200,7 +234,7 @@ BOOST_AUTO_TEST_CASE(compiler_arithmetics_2) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Arithmetics 2", {}, {10, 8, 12, 36});
 }
@@ -228,7 +262,7 @@ BOOST_AUTO_TEST_CASE(compiler_arithmetics_minus) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Arithmetics 'minus'", {}, {0, 2, 2, 0, 3, 3});
 }
@@ -250,7 +284,7 @@ BOOST_AUTO_TEST_CASE(compiler_comparisons) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Comparisons", {}, {1, 0, 0});
 }
@@ -276,9 +310,9 @@ BOOST_AUTO_TEST_CASE(compiler_comparisons_2) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
-    bfc_check(program, "Comparisons 2", {}, {1, 0, 1, 0, 0});
+    bfc_check(program, "Comparisons 2", {}, {1, 0, 1, 0, 0}, 950);
 }
 
 // ----- Compiler: Comparisons operator precedence -----------------------------
@@ -299,7 +333,7 @@ BOOST_AUTO_TEST_CASE(compiler_comp_op_precedence) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
 
     bfc_check(program, "Comparisons operator precedence", {}, {1, 1, 0});
 }
@@ -314,7 +348,7 @@ BOOST_AUTO_TEST_CASE(compiler_conditional_statements) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result = "test";
 
     bfc_check(program, "Conditional statements", {}, {result.begin(), result.end()});
@@ -332,7 +366,7 @@ BOOST_AUTO_TEST_CASE(compiler_conditional_statements_2) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result = "test";
 
     bfc_check(program, "Conditional statements 2", {}, {result.begin(), result.end()});
@@ -363,7 +397,7 @@ BOOST_AUTO_TEST_CASE(compiler_conditionals_scopes) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result = "result";
 
     bfc_check(program, "Conditionals and scopes", {}, {result.begin(), result.end()});
@@ -383,10 +417,10 @@ BOOST_AUTO_TEST_CASE(compiler_while_loop) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result(5, 'x');
 
-    bfc_check(program, "While loop", {}, {result.begin(), result.end()});
+    bfc_check(program, "While loop", {}, {result.begin(), result.end()}, 650);
 }
 
 // ----- Compiler: For loop ----------------------------------------------------
@@ -399,10 +433,10 @@ BOOST_AUTO_TEST_CASE(compiler_for_loop) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result(5, 'x');
 
-    bfc_check(program, "For loop", {}, {result.begin(), result.end()});
+    bfc_check(program, "For loop", {}, {result.begin(), result.end()}, 700);
 }
 
 // ----- Compiler: For loop 2 --------------------------------------------------
@@ -418,7 +452,7 @@ BOOST_AUTO_TEST_CASE(compiler_for_loop_2) {
     )";
 
     bf::compiler bfc;
-    const std::string program = bfc.compile(source);
+    const checked_program<> program(bfc.compile(source));
     const std::string result(5, 'y');
 
     bfc_check(program, "For loop 2", {}, {result.begin(), result.end()});
@@ -500,3 +534,88 @@ BOOST_AUTO_TEST_CASE(compiler_function_recursion_2) {
     bf::compiler bfc;
     BOOST_CHECK_THROW(bfc.compile(source), std::exception);
 }
+
+// ----- Compiler: Closed-form multiplication ----------------------------------
+BOOST_AUTO_TEST_CASE(compiler_closed_form_multiplication) {
+    const std::string source = R"(
+        function main() {
+            var a; var b;
+            scan a; scan b;
+            print a * b;
+        }
+    )";
+
+    bf::compiler bfc;
+    bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::loop_profiler> test(bfc.compile(source));
+    test.send_input({200, 250});
+    BOOST_CHECK(test.run() == bf::run_status::halted);
+    BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({50000 % 256}));
+    BOOST_CHECK(test.get_profiler().instructions() < 100);
+}
+
+// ----- Compiler: Prefix evaluation -------------------------------------------
+BOOST_AUTO_TEST_CASE(compiler_prefix_evaluation) {
+    const std::string source = R"(
+        function main() {
+            print "Enter a number: ";
+            var a = 42;
+            var b = a * 3 + 7;
+            scan a;
+            print a + b;
+        }
+    )";
+
+    bf::compiler bfc;
+    const std::string program = bfc.compile(source);
+    using profiled = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::loop_profiler>;
+    profiled full(std::make_shared<const bf::prepared_program>(program));
+    profiled partial(std::make_shared<const bf::prepared_program>(program, bf::cell_type(), true));
+    for (profiled *test : {&full, &partial}) {
+        test->send_input({7});
+        BOOST_CHECK(test->run() == bf::run_status::halted);
+        const auto output = test->recv_output();
+        BOOST_CHECK(std::string(output.begin(), output.end()) == std::string("Enter a number: ") + char(7 + 42 * 3 + 7));
+    }
+    // Only the banner is left of the prefix, one instruction per character.
+    BOOST_TEST_MESSAGE("Instructions: " + std::to_string(full.get_profiler().instructions())
+                       + " -> " + std::to_string(partial.get_profiler().instructions()));
+    BOOST_CHECK(partial.get_profiler().instructions() * 3 < full.get_profiler().instructions());
+}
+
+// ----- Compiler: Code map ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(compiler_code_map) {
+    const std::string source = R"(
+        function count(x) {
+            var i = 0;
+            while (i < x)
+                i = i + 1;
+            return i;
+        }
+        function main() {
+            var a;
+            scan a;
+            print count(a);
+        }
+    )";
+
+    bf::compiler bfc;
+    bf::code_map map;
+    const std::string program = bfc.compile(source, &map);
+    BOOST_REQUIRE(!map.empty());
+    BOOST_CHECK(std::any_of(map.begin(), map.end(), [](const bf::code_origin &origin) {
+        return origin.function == "main" && origin.statement == "Scan 'a'" && origin.comment == "Read input to 'a'";
+    }));
+
+    // Most steps are spent comparing in 'count'.
+    bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::loop_profiler> test(program);
+    test.send_input({90});
+    BOOST_CHECK(test.run() == bf::run_status::halted);
+    BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({90}));
+
+    const auto steps = test.get_profiler().aggregate([&map](std::uint32_t position) {
+        const bf::code_origin *origin = bf::find_origin(map, position);
+        return origin ? origin->function + ": " + origin->operation : std::string();
+    });
+    BOOST_REQUIRE(!steps.empty());
+    BOOST_CHECK_EQUAL(steps.front().first, "count: var::lower_than");
+}
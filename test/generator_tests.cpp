@@ -9,27 +9,48 @@
 
 template <typename memory_type = unsigned char>
 void bfg_check(const std::string &program, const std::string &description,
-        const std::vector<memory_type> &input, const std::vector<memory_type> &expected_output)
+        const std::vector<memory_type> &input, const std::vector<memory_type> &expected_output,
+        std::uint64_t max_instructions = 0)
 {
-    bf::interpreter<memory_type> test(program);
-    test.send_input(input);
-    test.run();
-    const auto received_output = test.recv_output();
-
-    BOOST_CHECK_MESSAGE(std::equal(expected_output.begin(), expected_output.end(),
-                                   received_output.begin(), received_output.end()),
-                        "Unexpected result after processing '" + description + "'!");
-
-    // Ensure correct SP movement
-    BOOST_CHECK(test.get_memory().at(0) == 1);
-    BOOST_CHECK(test.get_stack_pointer() == 0);
-
-    BOOST_TEST_MESSAGE("----- Results for '" + description + "' -----");
-    std::string output_int;
-    for (auto v : received_output)
-        output_int += " " + std::to_string(v);
-    BOOST_TEST_MESSAGE("Received output (as int):" + output_int);
-    BOOST_TEST_MESSAGE("Memory used: " + std::to_string(test.get_memory().size()));
+    // Run on all engines
+    const auto prepared = std::make_shared<const bf::prepared_program>(
+        program, bf::interpreter<memory_type>::cells());
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<memory_type>::supports(engine))
+            continue;
+        bf::interpreter<memory_type> test(prepared, engine);
+        test.send_input(input);
+        BOOST_CHECK_MESSAGE(test.run() == bf::run_status::halted,
+                            "Missing input after processing '" + description + "'!");
+        const auto received_output = test.recv_output();
+
+        BOOST_CHECK_MESSAGE(std::equal(expected_output.begin(), expected_output.end(),
+                                       received_output.begin(), received_output.end()),
+                            "Unexpected result after processing '" + description + "'!");
+
+        // Ensure correct SP movement
+        BOOST_CHECK(test.get_memory().at(0) == 1);
+        BOOST_CHECK(test.get_stack_pointer() == 0);
+
+        BOOST_TEST_MESSAGE("----- Results for '" + description + "' -----");
+        std::string output_int;
+        for (auto v : received_output)
+            output_int += " " + std::to_string(v);
+        BOOST_TEST_MESSAGE("Received output (as int):" + output_int);
+        BOOST_TEST_MESSAGE("Memory used: " + std::to_string(test.get_memory().size()));
+    }
+
+    // Executed instructions, to catch generated code getting slower. Only
+    // checked against 'max_instructions' if given.
+    bf::interpreter<memory_type, bf::vector_tape<memory_type>, bf::step_counter> counted(program);
+    counted.send_input(input);
+    counted.run();
+    const bf::run_statistics statistics = counted.statistics();
+    BOOST_TEST_MESSAGE("Executed instructions: " + std::to_string(statistics.instructions)
+                       + " (" + std::to_string(statistics.commands) + " commands)");
+    BOOST_CHECK_MESSAGE(max_instructions == 0 || statistics.instructions <= max_instructions,
+                        "Executed " + std::to_string(statistics.instructions) + " instructions for '"
+                        + description + "', expected at most " + std::to_string(max_instructions) + "!");
 }
 
 // ----- bf::var::add(unsigned) ------------------------------------------------
@@ -74,6 +95,27 @@ BOOST_AUTO_TEST_CASE(var__subtract_unsigned) {
     bfg_check(program, "10 - 2 == 8", {10}, {8});
 }
 
+// ----- bf::var::add(unsigned) with large constants ---------------------------
+BOOST_AUTO_TEST_CASE(var__add_unsigned_large) {
+    std::string program;
+    {
+        bf::generator bfg;
+        auto begin = bfg.new_var();
+
+        auto a = bfg.new_var("a", 70000);
+        a->add(1000);
+        a->subtract(3001);
+        a->write_output();
+
+        // Ensure correct SP movement
+        begin->add(1);
+        program = bfg.get_code();
+        BOOST_CHECK(bfg.get_minimal_code().size() < 2000);
+    }
+
+    bfg_check<std::uint32_t>(program, "70000 + 1000 - 3001 == 67999", {}, {67999});
+}
+
 // ----- bf::var::multiply(unsigned) -------------------------------------------
 BOOST_AUTO_TEST_CASE(var__multiply_unsigned) {
     std::string program;
@@ -781,3 +823,34 @@ BOOST_AUTO_TEST_CASE(example_ggt) {
     bfg_check     (program, "ggt(9,    13)   == 1",   {9,    13},   {1});
     bfg_check<int>(program, "ggt(3528, 3780) == 252", {3528, 3780}, {252});
 }
+
+// ----- bf::generator::get_minimal_code(code_map*) ----------------------------
+BOOST_AUTO_TEST_CASE(generator__code_map) {
+    bf::generator bfg;
+    auto a = bfg.new_var("a", 2);
+    auto b = bfg.new_var("b");
+    b->copy(*a);
+
+    bf::code_map map;
+    const std::string code = bfg.get_minimal_code(&map);
+    BOOST_CHECK(code == bfg.get_minimal_code());
+    BOOST_REQUIRE(!map.empty());
+
+    // Ranges are sorted and start with a Brainfuck operation.
+    for (std::size_t i = 0; i < map.size(); ++i) {
+        BOOST_CHECK(map[i].begin < map[i].end);
+        BOOST_CHECK(i == 0 || map[i - 1].end <= map[i].begin);
+        BOOST_CHECK(bf::bf_ops.find(code.at(map[i].begin)) != std::string::npos);
+        BOOST_CHECK(bf::find_origin(map, map[i].begin) == &map[i]);
+    }
+    BOOST_CHECK(bf::find_origin(map, code.size() - 1) == nullptr); // Padding
+
+    const bf::code_origin &first = map.front();
+    BOOST_CHECK_EQUAL(first.operation, "generator::new_var");
+    BOOST_CHECK_EQUAL(first.debug, "(Debug 0) Declare variable 'a' at position 0");
+    BOOST_CHECK_EQUAL(first.comment, "Set 'a' to 2");
+
+    const bf::code_origin &last = map.back();
+    BOOST_CHECK_EQUAL(last.operation, "var::copy");
+    BOOST_CHECK(last.debug.find("Copy from 'a' to 'b'") != std::string::npos);
+}
@@ -0,0 +1,294 @@
+/* Benchmark of the interpreter engines on compiled example programs. Prints
+ * the average run time (without construction) per program and engine.
+ *
+ * As a baseline, the programs are also translated to C and compiled by the
+ * system C compiler, if available. Their wall time includes starting the
+ * process, which dominates small programs, so the start up time of an empty
+ * native executable is printed below the table for comparison.
+ *
+ * A second table shows the engines with run limits, which are never reached,
+ * to compare the cost of checking limits against the unlimited runs.
+ *
+ * A third table compares a batch of inputs run one after another with the
+ * same batch run in lockstep, both on a single core. Lockstep runs pay off
+ * most if the branches do not depend on the input, as in "Uniform loops". In
+ * "example.bfc", the input steers the branches, so lanes split off early.
+ *
+ * A fourth table compares preparing each program (lowering and partial
+ * evaluation) with loading it from the on-disk cache of prepared programs.
+ *
+ * A fifth table compares the default interpreter with instantiations with
+ * all policies off and all on (profiling, checks and tracing), each on the
+ * threaded engine.
+ */
+
+#include "../bf/c_backend.h"
+#include "../bf/compiler.h"
+#include "../bf/interpreter.h"
+#include "../bf/lockstep.h"
+#include "../bf/profiler.h"
+#include "../bf/tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+struct workload {
+    std::string                name;
+    std::string                program;
+    std::vector<unsigned char> input;
+};
+
+// Run 'w' repeatedly and return the average run time in microseconds.
+template <typename interpreter_type>
+double measure(const workload &w, bf::engine engine, unsigned repetitions,
+               const bf::run_limits &limits = bf::run_limits()) {
+    std::chrono::steady_clock::duration total{};
+    for (unsigned r = 0; r < repetitions; ++r) {
+        interpreter_type test(w.program, engine);
+        test.send_input(w.input);
+        const auto start = std::chrono::steady_clock::now();
+        test.run(limits);
+        total += std::chrono::steady_clock::now() - start;
+    }
+    return std::chrono::duration<double, std::micro>(total).count() / repetitions;
+}
+
+// Run 'w' for 'batch' different inputs, one after another or in lockstep,
+// and return the average run time of the whole batch in microseconds.
+double measure_batch(const workload &w, std::size_t batch, bool lockstep, unsigned repetitions) {
+    const auto program = std::make_shared<const bf::prepared_program>(w.program);
+    std::vector<std::vector<unsigned char>> inputs(batch, w.input);
+    for (std::size_t i = 0; i < batch; ++i)
+        inputs[i][0] += static_cast<unsigned char>(i % 8);
+
+    std::chrono::steady_clock::duration total{};
+    for (unsigned r = 0; r < repetitions; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        if (lockstep)
+            bf::run_lockstep(program, inputs);
+        else
+            for (const auto &input : inputs) {
+                bf::interpreter<> test(program);
+                test.send_input(input);
+                test.run();
+            }
+        total += std::chrono::steady_clock::now() - start;
+    }
+    return std::chrono::duration<double, std::micro>(total).count() / repetitions;
+}
+
+// Prepare 'w' with partial evaluation, from scratch or from the cache in
+// 'directory', and return the average time in microseconds.
+double measure_prepare(const workload &w, const std::string &directory, bool cached, unsigned repetitions) {
+    std::chrono::steady_clock::duration total{};
+    for (unsigned r = 0; r < repetitions; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        if (cached)
+            bf::prepared_program::cached(directory, w.program, bf::cell_type(), true);
+        else
+            bf::prepared_program(w.program, bf::cell_type(), true);
+        total += std::chrono::steady_clock::now() - start;
+    }
+    return std::chrono::duration<double, std::micro>(total).count() / repetitions;
+}
+
+#ifndef _WIN32
+// Build 'w' with the C backend and return its average wall time, including
+// process start up, in microseconds.
+double measure_native(const workload &w, unsigned repetitions) {
+    bf::compile_c(bf::emit_c(w.program), "benchmark_native", "cc -O2");
+    std::ofstream("benchmark_native.in", std::ios::binary).write(
+        reinterpret_cast<const char*>(w.input.data()), w.input.size());
+
+    std::chrono::steady_clock::duration total{};
+    for (unsigned r = 0; r < repetitions; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        if (std::system("./benchmark_native < benchmark_native.in > /dev/null") != 0)
+            throw std::runtime_error("Native executable failed!");
+        total += std::chrono::steady_clock::now() - start;
+    }
+    std::remove("benchmark_native");
+    std::remove("benchmark_native.in");
+    return std::chrono::duration<double, std::micro>(total).count() / repetitions;
+}
+#endif
+
+int main(int argc, char **argv) {
+    const unsigned repetitions = argc > 1 ? std::stoul(argv[1]) : 200;
+
+    // Programs from test/compiler_tests.cpp and the example
+    const std::vector<std::pair<std::string, std::string>> sources = {
+        {"Min/Max", R"(
+            function main() {
+                var  a; var  b;
+                scan a; scan b;
+                print min(a, b);
+                print max(a, b);
+            }
+            function min(a, b) {
+                if (a < b) return a;
+                else       return b;
+            }
+            function max(a, b) {
+                if (a > b) return a;
+                else       return b;
+            }
+        )"},
+        {"Arithmetics 2", R"(
+            function main() {
+                var n10 = 1 + 3 * 3;
+                var n8  = (1 + 3) * 2;
+                var n12 = (5 - 2 + 1) * (1 + 2);
+                var n36 = (n10 - 8) * 2 + n8 + 2 * n12;
+                print n10; print n8; print n12; print n36;
+            }
+        )"},
+        {"Comparisons 2", R"(
+            function main() {
+                var a = 2;
+                var b = 5;
+                var t1 = a < b && !(a > b);
+                var f1 = a > b || 0;
+                var t2 = a > b && 0 || 1;
+                var f2 = a == b && a != b;
+                var f3 = 1 > 2 || 5 == 6;
+                print t1; print f1; print t2; print f2; print f3;
+            }
+        )"},
+        {"While loop", R"(
+            function main() {
+                var a = 2;
+                var b = 200;
+                while (a < b) {
+                    print "x";
+                    b = b - 1;
+                }
+            }
+        )"}
+    };
+
+    bf::compiler bfc;
+    std::vector<workload> workloads;
+    for (const auto &source : sources)
+        workloads.push_back({source.first, bfc.compile(source.second), {200, 100}});
+
+    // Counted loops around arithmetic on four input cells: All inputs take
+    // the same branches (the copy loops are folded).
+    workloads.push_back({"Uniform loops", ",>,>,>,>>>" + std::string(100, '+') + "[<" + std::string(100, '+')
+                         + "[<<<<<[->+>+<<]>>>[-<<<+>>>]<+++>>-<<<<++>>>>>-]>-]<<<<<<.>.>.>.", {200, 100, 7, 9}});
+
+    std::ifstream example("example.bfc");
+    if (example) {
+        const std::string source(std::istreambuf_iterator<char>(example), {});
+        const std::string input = "60\n40\n";
+        workloads.push_back({"example.bfc", bfc.compile(source), {input.begin(), input.end()}});
+    }
+
+    using interpreter_type = bf::interpreter<>;
+    const std::vector<std::pair<std::string, bf::engine>> engines = {
+        {"switch [us]",   bf::engine::switch_dispatch},
+        {"threaded [us]", bf::engine::threaded},
+        {"jit [us]",      bf::engine::jit}
+    };
+
+#ifndef _WIN32
+    const bool native = std::system("cc --version > /dev/null 2>&1") == 0;
+    const double startup = native ? measure_native({"Empty", "", {}}, repetitions) : 0;
+#else
+    const bool native = false;
+#endif
+
+    std::cout << std::left << std::setw(16) << "Program" << std::right;
+    for (const auto &e : engines)
+        std::cout << std::setw(15) << e.first;
+    if (native)
+        std::cout << std::setw(19) << "native+start [us]";
+    std::cout << '\n';
+
+    for (const auto &w : workloads) {
+        std::cout << std::left << std::setw(16) << w.name << std::right << std::fixed << std::setprecision(2);
+        for (const auto &e : engines) {
+            if (interpreter_type::supports(e.second))
+                std::cout << std::setw(15) << measure<interpreter_type>(w, e.second, repetitions);
+            else
+                std::cout << std::setw(15) << "-";
+        }
+#ifndef _WIN32
+        if (native)
+            std::cout << std::setw(19) << measure_native(w, repetitions);
+#endif
+        std::cout << '\n';
+    }
+#ifndef _WIN32
+    if (native)
+        std::cout << "Start up of an empty native executable: " << startup << " us\n";
+#endif
+
+    bf::run_limits limits;
+    limits.iterations = std::numeric_limits<std::uint64_t>::max() - 1;
+    limits.deadline   = std::chrono::steady_clock::now() + std::chrono::hours(24);
+
+    std::cout << "\nWith run limits\n" << std::left << std::setw(16) << "Program" << std::right;
+    for (const auto &e : engines)
+        std::cout << std::setw(15) << e.first;
+    std::cout << '\n';
+
+    for (const auto &w : workloads) {
+        std::cout << std::left << std::setw(16) << w.name << std::right << std::fixed << std::setprecision(2);
+        for (const auto &e : engines) {
+            if (interpreter_type::supports(e.second))
+                std::cout << std::setw(15) << measure<interpreter_type>(w, e.second, repetitions, limits);
+            else
+                std::cout << std::setw(15) << "-";
+        }
+        std::cout << '\n';
+    }
+
+    const std::size_t batch = 64;
+    std::cout << "\nBatch of " << batch << " inputs\n" << std::left << std::setw(16) << "Program" << std::right
+              << std::setw(15) << "switch [us]" << std::setw(15) << "lockstep [us]" << '\n';
+    for (const auto &w : workloads) {
+        std::cout << std::left << std::setw(16) << w.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(15) << measure_batch(w, batch, false, repetitions / 10 + 1)
+                  << std::setw(15) << measure_batch(w, batch, true, repetitions / 10 + 1) << '\n';
+    }
+
+    using all_off = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::no_profiler,
+                                    bf::overflow::wrap, bf::no_checks, bf::no_tracer>;
+    using all_on  = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::loop_profiler,
+                                    bf::overflow::wrap, bf::all_checks, bf::io_tracer>;
+    std::cout << "\nPolicies (threaded)\n" << std::left << std::setw(16) << "Program" << std::right
+              << std::setw(15) << "default [us]" << std::setw(15) << "all off [us]" << std::setw(15) << "all on [us]"
+              << '\n';
+    for (const auto &w : workloads) {
+        std::cout << std::left << std::setw(16) << w.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(15) << measure<interpreter_type>(w, bf::engine::threaded, repetitions)
+                  << std::setw(15) << measure<all_off>(w, bf::engine::threaded, repetitions)
+                  << std::setw(15) << measure<all_on>(w, bf::engine::threaded, repetitions) << '\n';
+    }
+
+#ifndef _WIN32
+    if (std::system("mkdir -p benchmark_cache") == 0) {
+        std::cout << "\nCold start\n" << std::left << std::setw(16) << "Program" << std::right
+                  << std::setw(15) << "prepare [us]" << std::setw(15) << "cached [us]" << '\n';
+        for (const auto &w : workloads) {
+            bf::prepared_program::cached("benchmark_cache", w.program, bf::cell_type(), true);
+            std::cout << std::left << std::setw(16) << w.name << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(15) << measure_prepare(w, "benchmark_cache", false, repetitions)
+                      << std::setw(15) << measure_prepare(w, "benchmark_cache", true, repetitions) << '\n';
+        }
+        std::system("rm -rf benchmark_cache");
+    }
+#endif
+
+    return 0;
+}
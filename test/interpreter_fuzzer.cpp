@@ -0,0 +1,363 @@
+/* Differential fuzzer of the interpreter engines. Random, balanced Brainfuck
+ * programs and inputs are run by a naive reference, which interprets the
+ * source code directly, and by every engine, tape and cell type combination
+ * (including partial evaluation and lockstep runs). Output, tape and stack
+ * pointer have to be identical.
+ *
+ * Programs are derived from arbitrary bytes, so the same target serves both
+ * drivers: Built with -DBF_LIBFUZZER and -fsanitize=fuzzer (clang), it is a
+ * libFuzzer target, e.g.
+ *     clang++ -std=c++14 -O1 -g -fsanitize=fuzzer,address -DBF_LIBFUZZER \
+ *         test/interpreter_fuzzer.cpp bf/bytecode.cpp bf/jit.cpp \
+ *         bf/prepared_program.cpp bf/profiler.cpp bf/thread_pool.cpp
+ * Otherwise, it has a standalone driver feeding random bytes, which is run by
+ * "make fuzz": interpreter_fuzzer [iterations] [seed]
+ *
+ * The reference stops after a fixed number of steps. Programs which do not
+ * halt or need input before are skipped. The stack pointer may pass cells below
+ * zero, but accessing one (or halting there) fails. Cells below zero, which
+ * are only reached by an offset, are padding for the engines, so programs
+ * failing this way are only compared against engines with bounds checks.
+ */
+
+#include "../bf/interpreter.h"
+#include "../bf/batch.h"
+#include "../bf/lockstep.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const std::uint64_t reference_steps = 100000;
+
+// Runs compared against the reference, i.e. not skipped
+unsigned long compared = 0;
+
+// Turn arbitrary bytes into a program and its input: The first byte gives the
+// number of input bytes, which follow. Each remaining byte picks a token,
+// common loop idioms included. Brackets are balanced afterwards.
+void decode(const std::uint8_t *data, std::size_t size, std::string &program, std::vector<std::uint8_t> &input) {
+    static const char *const tokens[] = {
+        "+", "-", ">", "<", ".", ",", "[", "]",
+        "+", "-", ">", "<", "[-]", "[>+<-]", "[->>+<<]", "[>]",
+        "[<]", "[>>]", "++++", "----", "[-<+>]", "[>+>+<<-]", "+[", "-]"
+    };
+    std::size_t position = 0;
+    const std::size_t count = size > 0 ? data[position++] % 8 : 0;
+    for (; position < size && input.size() < count; ++position)
+        input.push_back(data[position]);
+
+    int depth = 0;
+    for (; position < size; ++position) {
+        const std::string token = tokens[data[position] % (sizeof(tokens) / sizeof(tokens[0]))];
+        for (const char c : token) {
+            if (c == ']' && depth == 0)
+                continue;
+            depth += c == '[' ? 1 : c == ']' ? -1 : 0;
+            program += c;
+        }
+    }
+    program.append(depth, ']');
+}
+
+struct outcome {
+    enum kind_t {halted, needs_input, overflow, other} kind;
+    std::vector<std::uint64_t> output;
+    std::vector<std::uint64_t> tape; // Without trailing zeros
+    std::size_t stack_pointer;
+
+    std::string describe() const {
+        static const char *const kinds[] = {"halted", "needs input", "overflow", "other"};
+        std::ostringstream out;
+        out << kinds[kind] << ", sp " << stack_pointer << ", output";
+        for (const auto v : output)
+            out << ' ' << v;
+        out << ", tape";
+        for (const auto v : tape)
+            out << ' ' << v;
+        return out.str();
+    }
+};
+
+template <typename value_type>
+std::vector<std::uint64_t> widen(const std::vector<value_type> &cells, bool trim) {
+    std::vector<std::uint64_t> result(cells.begin(), cells.end());
+    while (trim && !result.empty() && result.back() == 0)
+        result.pop_back();
+    return result;
+}
+
+// Run 'program' directly from source, one character at a time. Returns false
+// if it neither halts nor needs input within 'reference_steps'. Accessing a
+// cell below zero is an error ('outcome::other').
+template <typename memory_type, bf::overflow overflow_mode>
+bool reference(const std::string &program, const std::vector<memory_type> &input, outcome &result) {
+    std::vector<std::size_t> match(program.size());
+    std::vector<std::size_t> stack;
+    for (std::size_t i = 0; i < program.size(); ++i) {
+        if (program[i] == '[')
+            stack.push_back(i);
+        else if (program[i] == ']') {
+            match[i] = stack.back();
+            match[stack.back()] = i;
+            stack.pop_back();
+        }
+    }
+
+    const memory_type max = std::numeric_limits<memory_type>::max();
+    std::vector<memory_type> tape(1), output;
+    std::ptrdiff_t sp = 0;
+    std::size_t in = 0, ip = 0;
+    // Adds to cells below zero since the last other command. Lowering merges
+    // them and drops those which cancel out (for wrapping cells), so they only
+    // fail if they do not.
+    std::map<std::ptrdiff_t, memory_type> pending;
+    const auto below_zero = [&pending] {
+        for (const auto &p : pending) {
+            if (p.second != 0)
+                return true;
+        }
+        pending.clear();
+        return false;
+    };
+    result.kind = outcome::halted;
+    for (std::uint64_t step = 0; ip < program.size(); ++ip, ++step) {
+        if (step == reference_steps)
+            return false;
+        const char command = program[ip];
+        if (sp < 0 && (command == '+' || command == '-') && overflow_mode == bf::overflow::wrap) {
+            pending[sp] += command == '+' ? 1 : -1;
+            continue;
+        }
+        if (command != '>' && command != '<' && command != '+' && command != '-' && below_zero()) {
+            result.kind = outcome::other;
+            break;
+        }
+        const bool access = command != '>' && command != '<' && (command != ',' || in < input.size());
+        if (sp < 0 && access) {
+            result.kind = outcome::other;
+            break;
+        }
+        memory_type &cell = tape[sp < 0 ? 0 : sp];
+        switch (command) {
+        case '+': if (cell == max && overflow_mode != bf::overflow::wrap) {
+                      if (overflow_mode == bf::overflow::trap)
+                          result.kind = outcome::overflow;
+                  } else
+                      ++cell;
+                  break;
+        case '-': if (cell == 0 && overflow_mode != bf::overflow::wrap) {
+                      if (overflow_mode == bf::overflow::trap)
+                          result.kind = outcome::overflow;
+                  } else
+                      --cell;
+                  break;
+        case '>': if (++sp == static_cast<std::ptrdiff_t>(tape.size()))
+                      tape.push_back(0);
+                  break;
+        case '<': --sp;
+                  break;
+        case '.': output.push_back(cell);
+                  break;
+        case ',': if (in == input.size())
+                      result.kind = outcome::needs_input;
+                  else
+                      cell = input[in++];
+                  break;
+        case '[': if (cell == 0)
+                      ip = match[ip];
+                  break;
+        case ']': if (cell != 0)
+                      ip = match[ip];
+                  break;
+        }
+        if (result.kind != outcome::halted)
+            break;
+    }
+    if (result.kind == outcome::halted && (sp < 0 || below_zero()))
+        result.kind = outcome::other;
+    result.output = widen(output, false);
+    result.tape = widen(tape, true);
+    result.stack_pointer = static_cast<std::size_t>(sp);
+    return true;
+}
+
+// Compare 'actual' against 'expected' and report differences. The stack
+// pointer only matches at the end of the program, as moves are deferred.
+bool check(const std::string &program, const std::string &engine, const outcome &expected, const outcome &actual) {
+    bool same = actual.kind == expected.kind && actual.output == expected.output;
+    if (same && expected.kind != outcome::overflow && expected.kind != outcome::other)
+        same = actual.tape == expected.tape;
+    if (same && expected.kind == outcome::halted)
+        same = actual.stack_pointer == expected.stack_pointer;
+    if (!same) {
+        std::cerr << "Mismatch of " << engine << " for program '" << program << "'\n"
+                  << "  expected: " << expected.describe() << "\n"
+                  << "  actual:   " << actual.describe() << "\n";
+    }
+    return same;
+}
+
+template <typename memory_type, typename tape_type, bf::overflow overflow_mode, typename checks_type = bf::default_checks>
+bool check_interpreters(const std::string &program, const std::vector<memory_type> &input,
+                        const outcome &expected, const std::string &name) {
+    using interpreter_type = bf::interpreter<memory_type, tape_type, bf::no_profiler, overflow_mode, checks_type>;
+    bool same = true;
+    for (const bool partial_evaluation : {false, true}) {
+        const auto prepared = std::make_shared<const bf::prepared_program>(
+            program, interpreter_type::cells(), partial_evaluation);
+        for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+            if (!interpreter_type::supports(engine))
+                continue;
+            static const char *const engines[] = {"switch", "threaded", "jit"};
+            const std::string description = name + ", " + engines[static_cast<int>(engine)]
+                                          + (partial_evaluation ? ", partially evaluated" : "");
+
+            interpreter_type test(prepared, engine);
+            test.send_input(input);
+            bf::run_limits limits;
+            limits.iterations = reference_steps; // Never reached, if all is fine
+            outcome actual;
+            try {
+                const bf::run_status status = test.run(limits);
+                actual.kind = status == bf::run_status::halted ? outcome::halted
+                            : status == bf::run_status::needs_input ? outcome::needs_input : outcome::other;
+            } catch (const std::runtime_error &e) {
+                actual.kind = std::string(e.what()) == "Cell overflow!" ? outcome::overflow : outcome::other;
+            }
+            actual.output = widen(test.recv_output(), false);
+            actual.tape = widen(test.get_memory(), true);
+            actual.stack_pointer = test.get_stack_pointer();
+            same = check(program, description, expected, actual) && same;
+        }
+    }
+    return same;
+}
+
+template <typename memory_type, bf::overflow overflow_mode>
+bool check_cells(const std::string &program, const std::vector<std::uint8_t> &bytes, const std::string &name) {
+    const std::vector<memory_type> input(bytes.begin(), bytes.end());
+    outcome expected;
+    if (!reference<memory_type, overflow_mode>(program, input, expected))
+        return true;
+    ++compared;
+
+    // Accesses below zero are only caught with bounds checks.
+    bool same = check_interpreters<memory_type, bf::vector_tape<memory_type>, overflow_mode, bf::all_checks>(
+        program, input, expected, name + " vector_tape checked");
+    same = check_interpreters<memory_type, bf::paged_tape<memory_type, 2>, overflow_mode, bf::all_checks>(
+        program, input, expected, name + " paged_tape checked") && same;
+#ifndef _WIN32
+    same = check_interpreters<memory_type, bf::guarded_tape<memory_type>, overflow_mode, bf::all_checks>(
+        program, input, expected, name + " guarded_tape checked") && same;
+#endif
+    if (expected.kind == outcome::other)
+        return same;
+
+    same = check_interpreters<memory_type, bf::vector_tape<memory_type>, overflow_mode>(
+        program, input, expected, name + " vector_tape") && same;
+    same = check_interpreters<memory_type, bf::paged_tape<memory_type, 2>, overflow_mode>(
+        program, input, expected, name + " paged_tape") && same;
+#ifndef _WIN32
+    same = check_interpreters<memory_type, bf::guarded_tape<memory_type>, overflow_mode>(
+        program, input, expected, name + " guarded_tape") && same;
+#endif
+    return same;
+}
+
+// Each lane gets its own input, derived from 'input' by rotating or
+// truncating it, so lanes take different branches and some run out of input.
+// The first lane is checked against the reference, all of them against
+// "run_batch".
+bool check_lockstep(const std::string &program, const std::vector<std::uint8_t> &input) {
+    outcome expected;
+    if (!reference<unsigned char, bf::overflow::wrap>(program, input, expected) || expected.kind == outcome::other)
+        return true;
+
+    std::vector<std::vector<unsigned char>> inputs;
+    for (std::size_t lane = 0; lane < 6; ++lane) {
+        std::vector<unsigned char> lane_input(input.begin(), input.end());
+        if (lane % 2 == 0 && !lane_input.empty())
+            std::rotate(lane_input.begin(), lane_input.begin() + lane / 2 % lane_input.size(), lane_input.end());
+        else
+            lane_input.resize(lane_input.size() > lane / 2 ? lane_input.size() - lane / 2 - 1 : 0);
+        inputs.push_back(lane_input);
+    }
+
+    static bf::thread_pool pool(2);
+    bf::run_limits limits;
+    limits.iterations = reference_steps;
+    const auto prepared = std::make_shared<const bf::prepared_program>(program);
+    const auto results = bf::run_lockstep<unsigned char, 4>(prepared, inputs, bf::engine::switch_dispatch, limits);
+    const auto batch = bf::run_batch(pool, prepared, inputs, bf::engine::switch_dispatch, limits);
+
+    outcome actual = expected;
+    actual.kind = results[0].error ? outcome::other
+                : results[0].status == bf::run_status::halted ? outcome::halted
+                : results[0].status == bf::run_status::needs_input ? outcome::needs_input : outcome::other;
+    actual.output = widen(results[0].output, false);
+    bool same = check(program, "lockstep", expected, actual);
+    for (std::size_t lane = 0; lane < inputs.size(); ++lane) {
+        if ((results[lane].error != nullptr) != (batch[lane].error != nullptr)
+                || (!results[lane].error && (results[lane].status != batch[lane].status
+                                             || results[lane].output != batch[lane].output))) {
+            std::cerr << "Mismatch of lockstep lane " << lane << " and batch for program '" << program << "'\n";
+            same = false;
+        }
+    }
+    return same;
+}
+
+// Run one program derived from 'data' on everything. Returns false on any mismatch.
+bool fuzz_one(const std::uint8_t *data, std::size_t size) {
+    std::string program;
+    std::vector<std::uint8_t> input;
+    decode(data, size, program, input);
+
+    bool same = check_cells<unsigned char, bf::overflow::wrap>(program, input, "8 bit wrap");
+    same = check_cells<unsigned short, bf::overflow::wrap>(program, input, "16 bit wrap") && same;
+    same = check_cells<unsigned char, bf::overflow::saturate>(program, input, "8 bit saturate") && same;
+    same = check_cells<unsigned char, bf::overflow::trap>(program, input, "8 bit trap") && same;
+    same = check_lockstep(program, input) && same;
+    return same;
+}
+
+} // namespace
+
+#ifdef BF_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data, std::size_t size) {
+    if (!fuzz_one(data, size))
+        std::abort();
+    return 0;
+}
+#else
+int main(int argc, char **argv) {
+    const unsigned long iterations = argc > 1 ? std::stoul(argv[1]) : 10000;
+    const unsigned long seed = argc > 2 ? std::stoul(argv[2]) : std::random_device()();
+    std::cout << "Fuzzing " << iterations << " programs, seed " << seed << std::endl;
+
+    std::mt19937 random(seed);
+    unsigned long failures = 0;
+    for (unsigned long i = 0; i < iterations; ++i) {
+        std::vector<std::uint8_t> data(std::uniform_int_distribution<std::size_t>(1, 64)(random));
+        for (auto &byte : data)
+            byte = static_cast<std::uint8_t>(random());
+        if (!fuzz_one(data.data(), data.size()))
+            ++failures;
+    }
+
+    std::cout << failures << " of " << iterations << " programs failed (" << compared
+              << " runs compared, the others skipped)" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+#endif
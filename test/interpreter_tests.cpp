@@ -0,0 +1,1172 @@
+#ifndef _WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+#define BOOST_TEST_MODULE interpreter
+#include <boost/test/unit_test.hpp>
+
+#include "../bf/batch.h"
+#include "../bf/bytecode.h"
+#include "../bf/c_backend.h"
+#include "../bf/interpreter.h"
+#include "../bf/lockstep.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <sstream>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+template <typename memory_type, typename tape_type>
+void bfi_check_tape(const std::string &program, const std::string &description,
+        const std::vector<memory_type> &input, const std::vector<memory_type> &expected_output)
+{
+    const auto prepared = std::make_shared<const bf::prepared_program>(
+        program, bf::interpreter<memory_type>::cells());
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<memory_type, tape_type>::supports(engine))
+            continue;
+        bf::interpreter<memory_type, tape_type> test(prepared, engine);
+        test.send_input(input);
+        BOOST_CHECK_MESSAGE(test.run() == bf::run_status::halted,
+                            "Missing input after processing '" + description + "'!");
+        const auto received_output = test.recv_output();
+
+        BOOST_CHECK_MESSAGE(std::equal(expected_output.begin(), expected_output.end(),
+                                       received_output.begin(), received_output.end()),
+                            "Unexpected result after processing '" + description + "'!");
+    }
+}
+
+template <typename memory_type = unsigned char>
+void bfi_check(const std::string &program, const std::string &description,
+        const std::vector<memory_type> &input, const std::vector<memory_type> &expected_output)
+{
+    bfi_check_tape<memory_type, bf::vector_tape<memory_type>>(program, description, input, expected_output);
+    bfi_check_tape<memory_type, bf::paged_tape<memory_type>>(program, description, input, expected_output);
+#ifndef _WIN32
+    bfi_check_tape<memory_type, bf::guarded_tape<memory_type>>(program, description, input, expected_output);
+#endif
+}
+
+// ----- Bytecode: Run folding -------------------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_run_folding) {
+    const auto code = bf::lower("+++ comment >>>><- +-\n<>");
+
+    BOOST_REQUIRE(code.size() == 3);
+    BOOST_CHECK(code[0].op == bf::opcode::add  && code[0].offset == 0 && code[0].value == 3);
+    BOOST_CHECK(code[1].op == bf::opcode::add  && code[1].offset == 3 && code[1].value == -1);
+    BOOST_CHECK(code[2].op == bf::opcode::move && code[2].value == 3);
+}
+
+// ----- Bytecode: Offset addressing -------------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_offset_addressing) {
+    // Moves are deferred to loop boundaries
+    auto code = bf::lower(">+<<-.>>+<,[>]<");
+    BOOST_REQUIRE(code.size() == 7);
+    BOOST_CHECK(code[0].op == bf::opcode::add   && code[0].offset == 1  && code[0].value == 1);
+    BOOST_CHECK(code[1].op == bf::opcode::add   && code[1].offset == -1 && code[1].value == -1);
+    BOOST_CHECK(code[2].op == bf::opcode::write && code[2].offset == -1);
+    BOOST_CHECK(code[3].op == bf::opcode::add   && code[3].offset == 1  && code[3].value == 1);
+    BOOST_CHECK(code[4].op == bf::opcode::read  && code[4].offset == 0);
+    BOOST_CHECK(code[5].op == bf::opcode::scan);
+    BOOST_CHECK(code[6].op == bf::opcode::move  && code[6].value == -1);
+    BOOST_CHECK(bf::min_offset(code) == -1 && bf::max_offset(code) == 1);
+
+    // Adds to the same cell are merged, but not across other instructions
+    code = bf::lower("+.+>-<-");
+    BOOST_REQUIRE(code.size() == 3);
+    BOOST_CHECK(code[2].op == bf::opcode::add && code[2].offset == 1 && code[2].value == -1);
+
+    bfi_check("+>>+<-.>+<,[>]<.", "Offset addressing", {7}, {255, 2});
+}
+
+// ----- Bytecode: Loop targets ------------------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_loop_targets) {
+    const auto code = bf::lower("[>[.]<-]");
+
+    BOOST_REQUIRE(code.size() == 8);
+    BOOST_CHECK(code[0].op == bf::opcode::jump_zero     && code[0].target == 8);
+    BOOST_CHECK(code[2].op == bf::opcode::jump_zero     && code[2].target == 5);
+    BOOST_CHECK(code[4].op == bf::opcode::jump_not_zero && code[4].target == 3);
+    BOOST_CHECK(code[7].op == bf::opcode::jump_not_zero && code[7].target == 1);
+}
+
+// ----- Bytecode: Unbalanced brackets -----------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_unbalanced_brackets) {
+    BOOST_CHECK_THROW(bf::lower("+[[-]"), std::logic_error);
+    BOOST_CHECK_THROW(bf::lower("+[-]]"), std::logic_error);
+    BOOST_CHECK_THROW(bf::interpreter<>("]["), std::logic_error);
+}
+
+// ----- Bytecode: Loop idioms -------------------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_loop_idioms) {
+    auto code = bf::lower("[-]");
+    BOOST_REQUIRE(code.size() == 1);
+    BOOST_CHECK(code[0].op == bf::opcode::clear && code[0].offset == 0);
+
+    code = bf::lower("[<+>>-->+<<-]");
+    BOOST_REQUIRE(code.size() == 4);
+    BOOST_CHECK(code[0].op == bf::opcode::multiply_add && code[0].offset == -1 && code[0].value == 1);
+    BOOST_CHECK(code[1].op == bf::opcode::multiply_add && code[1].offset == 1  && code[1].value == -2);
+    BOOST_CHECK(code[2].op == bf::opcode::multiply_add && code[2].offset == 2  && code[2].value == 1);
+    BOOST_CHECK(code[3].op == bf::opcode::clear);
+
+    // Incrementing control cell
+    code = bf::lower("[>+<+]");
+    BOOST_REQUIRE(code.size() == 2);
+    BOOST_CHECK(code[0].op == bf::opcode::multiply_add && code[0].offset == 1 && code[0].value == -1);
+
+    // Scan loops
+    code = bf::lower("[>][<<]");
+    BOOST_REQUIRE(code.size() == 2);
+    BOOST_CHECK(code[0].op == bf::opcode::scan && code[0].value == 1);
+    BOOST_CHECK(code[1].op == bf::opcode::scan && code[1].value == -2);
+
+    // No idioms
+    BOOST_CHECK(bf::lower("[>+<--]").size() == 4);
+    BOOST_CHECK(bf::lower("[>+<-.]").size() == 5);
+    BOOST_CHECK(bf::lower("[>+]").size() == 4);
+}
+
+// ----- Bytecode: Affine loops ------------------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_affine_loops) {
+    // Add cell 1 to cell 2 via cell 3, cell 0 times: 2 += 0 * 1
+    auto code = bf::lower("[>>>[-]<<[>+>+<<-]>>[<<+>>-]<<<-]");
+    BOOST_REQUIRE(code.size() == 3);
+    BOOST_CHECK(code[0].op == bf::opcode::product_add && code[0].offset == 2 && code[0].source() == 1
+                && code[0].value == 1);
+    BOOST_CHECK(code[1].op == bf::opcode::conditional_set && code[1].offset == 3 && code[1].value == 0);
+    BOOST_CHECK(code[2].op == bf::opcode::clear && code[2].offset == 0);
+    BOOST_CHECK(bf::min_offset(code) == 0 && bf::max_offset(code) == 3);
+
+    // Constants are added, too. Incrementing control cell negates factors.
+    code = bf::lower("[>>[-]+++<<<++>+]");
+    BOOST_REQUIRE(code.size() == 3);
+    BOOST_CHECK(code[0].op == bf::opcode::multiply_add && code[0].offset == -1 && code[0].value == -2);
+    BOOST_CHECK(code[1].op == bf::opcode::conditional_set && code[1].offset == 2 && code[1].value == 3);
+
+    // Cell 1 is moved in the first iteration only, so it is no invariant.
+    BOOST_CHECK(bf::lower("[>[>+<-]<-]").size() > 3);
+    // Cell 2 is doubled in each iteration.
+    BOOST_CHECK(bf::lower("[>>[-<<<+>>>]<<<[->>>++<<<]>>-]").size() > 3);
+}
+
+// ----- Bytecode: Prefix evaluation -------------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_prefix_evaluation) {
+    // Output and tape of the prefix, then continue at the first read
+    auto code = bf::evaluate_prefix(bf::lower("++++++++[>++++++++<-]>+.>+++<,[.-]"));
+    BOOST_REQUIRE(code.size() >= 5);
+    BOOST_CHECK(code[0].op == bf::opcode::write_value && code[0].value == 65);
+    BOOST_CHECK(code[1].op == bf::opcode::add && code[1].offset == 1 && code[1].value == 65);
+    BOOST_CHECK(code[2].op == bf::opcode::add && code[2].offset == 2 && code[2].value == 3);
+    BOOST_CHECK(code[3].op == bf::opcode::read && code[3].offset == 1);
+    BOOST_CHECK(code[4].op == bf::opcode::move && code[4].value == 1);
+
+    // Loops around the first read are kept, with their targets shifted.
+    code = bf::evaluate_prefix(bf::lower("+++.[->,.<]"));
+    BOOST_REQUIRE(code.size() == 7);
+    BOOST_CHECK(code[0].op == bf::opcode::write_value && code[0].value == 3);
+    BOOST_CHECK(code[2].op == bf::opcode::jump_zero && code[2].target == 7);
+    BOOST_CHECK(code[6].op == bf::opcode::jump_not_zero && code[6].target == 3);
+
+    // Programs without input are evaluated completely, endless loops are not.
+    code = bf::evaluate_prefix(bf::lower("+++[>++<-]>[>+>+<<-]>>."));
+    BOOST_REQUIRE(code.size() == 4);
+    BOOST_CHECK(code[0].op == bf::opcode::write_value && code[0].value == 6);
+    BOOST_CHECK(code[3].op == bf::opcode::move && code[3].value == 3);
+    BOOST_CHECK(bf::evaluate_prefix(bf::lower("+[]")).size() == 3);
+    BOOST_CHECK(bf::evaluate_prefix(bf::lower(",+.")).size() == 3);
+    BOOST_CHECK(bf::evaluate_prefix(bf::lower("+"), nullptr, bf::cell_type::of<unsigned char>(bf::overflow::trap)).size() == 1);
+
+    // Same results on all engines, also when moving below zero
+    for (const std::string program : {"++++++++[>++++++++<-]>+.>+++<,[.-]", "+++.[->,.<]", "+>+++++[<<]>.",
+                                      "+++++++++[>++++[>+++<-]<-]>>.<<,[>.<-]", "+[>+>++<<-]>.>.<<<.", "+++[>++<-]>[>+>+<<-]<<+<.<"}) {
+        for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+            if (!bf::interpreter<>::supports(engine))
+                continue;
+            bf::interpreter<> full(program, engine);
+            bf::interpreter<> partial(std::make_shared<const bf::prepared_program>(program, bf::cell_type(), true), engine);
+            bf::run_status status[2];
+            for (auto *test : {&full, &partial}) {
+                test->send_input({3});
+                try {
+                    status[test == &partial] = test->run();
+                } catch (const std::runtime_error&) {
+                    status[test == &partial] = bf::run_status::budget_exhausted; // Marks the error
+                }
+            }
+            BOOST_CHECK_MESSAGE(status[0] == status[1] && full.recv_output() == partial.recv_output(),
+                                "Unexpected result after partial evaluation of '" + program + "'!");
+        }
+    }
+}
+
+// ----- Bytecode: Cell types --------------------------------------------------
+BOOST_AUTO_TEST_CASE(bytecode_cell_types) {
+    const bf::cell_type wrap16     = bf::cell_type::of<std::uint16_t>();
+    const bf::cell_type saturate8  = bf::cell_type::of<std::uint8_t>(bf::overflow::saturate);
+    const bf::cell_type trap32     = bf::cell_type::of<std::uint32_t>(bf::overflow::trap);
+
+    // Runs are reduced modulo the cell width.
+    const std::string plus_257(257, '+');
+    BOOST_CHECK(bf::lower(std::string(256, '+')).empty());
+    auto code = bf::lower(plus_257);
+    BOOST_REQUIRE(code.size() == 1);
+    BOOST_CHECK(code[0].value == 1);
+    code = bf::lower(plus_257, nullptr, wrap16);
+    BOOST_REQUIRE(code.size() == 1);
+    BOOST_CHECK(code[0].value == 257);
+    code = bf::lower("[>" + plus_257 + "<" + std::string(257, '-') + "]");
+    BOOST_REQUIRE(code.size() == 2);
+    BOOST_CHECK(code[0].op == bf::opcode::multiply_add && code[0].value == 1);
+
+    // Opposite adds are not merged, if the cell may saturate or trap.
+    BOOST_CHECK(bf::lower("+-", nullptr, saturate8).size() == 2);
+    BOOST_CHECK(bf::lower("++>-<+", nullptr, trap32).size() == 2);
+
+    // Only decrementing loops with a single add per cell are folded.
+    code = bf::lower("[->+>--<<]", nullptr, saturate8);
+    BOOST_REQUIRE(code.size() == 3);
+    BOOST_CHECK(code[1].op == bf::opcode::multiply_add && code[1].value == -2);
+    BOOST_CHECK(bf::lower("[+]", nullptr, saturate8).size() == 3);
+    BOOST_CHECK(bf::lower("[->+<>-<]", nullptr, trap32).size() > 3);
+}
+
+// ----- Interpreter: Echo -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_echo) {
+    bfi_check(",.>,.", "Echo", {4, 2}, {4, 2});
+}
+
+// ----- Interpreter: Wrap around ----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_wrap_around) {
+    bfi_check("-.+.", "Wrap around", {}, {255, 0});
+    bfi_check<unsigned short>("-.", "Wrap around (16 bit)", {}, {65535});
+}
+
+// ----- Interpreter: Nested loops ---------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_nested_loops) {
+    // 5 * 6 by nested loops, result at cell 2
+    bfi_check(",>,<[>[>+>+<<-]>>[<<+>>-]<<<-]>>.", "Multiply", {5, 6}, {30});
+}
+
+// ----- Interpreter: Loop idioms ----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_loop_idioms) {
+    bfi_check(",[->+>---<<]>.>.", "Multiply add", {7}, {7, 235});
+    bfi_check("+[>+<+]>.", "Incrementing control cell", {}, {255});
+    bfi_check<unsigned short>("+[>+<+]>.", "Incrementing control cell (16 bit)", {}, {65535});
+    bfi_check(",[-]>[<+>-]<.", "Clear and skipped loop", {9}, {0});
+}
+
+// ----- Interpreter: Scan loops -----------------------------------------------
+template <typename memory_type, typename tape_type = bf::vector_tape<memory_type>>
+void scan_check(const std::string &program, std::size_t expected_stack_pointer) {
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<memory_type, tape_type>::supports(engine))
+            continue;
+        bf::interpreter<memory_type, tape_type> test(program, engine);
+        test.run();
+        BOOST_CHECK_MESSAGE(test.get_stack_pointer() == expected_stack_pointer,
+                            "Unexpected stack pointer after processing '" + program + "'!");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_scan_loops) {
+    for (auto check : {scan_check<unsigned char>, scan_check<unsigned short>
+                     , scan_check<unsigned char, bf::paged_tape<unsigned char, 2>>
+#ifndef _WIN32
+                     , scan_check<unsigned char, bf::guarded_tape<unsigned char>>
+                     , scan_check<unsigned short, bf::guarded_tape<unsigned short>>
+#endif
+                     }) {
+        check("+>+>+>>+<<<<[>]", 3);
+        check("+>+<[>]", 2);                    // Behind end of memory
+        check("+>>+>>+>+<[>>]", 6);             // Strided
+        check("+>>+>>+>+<[>>>]", 7);            // Strided, behind end of memory
+        check(">+>+>+>>+>+[<]", 4);
+        check("+>+>>+>+>+>+[<<]", 2);
+        check(">>>[<]", 3);                     // Zero cell, no scan
+        BOOST_CHECK_THROW(check("+>+[<]", 0), std::runtime_error);
+        BOOST_CHECK_THROW(check("+>+>+[<<]", 0), std::runtime_error);
+    }
+}
+
+// ----- Interpreter: Affine loops --------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_affine_loops) {
+    const std::string multiply = ",>,<[>>>[-]<<[>+>+<<-]>>[<<+>>-]<<<-]>>.";
+    bfi_check(multiply, "7 * 9", {7, 9}, {63});
+    bfi_check(multiply, "200 * 3", {200, 3}, {88});
+    bfi_check(multiply, "0 * 5", {0, 5}, {0});
+    bfi_check<int>(multiply, "-7 * 1000", {-7, 1000}, {-7000});
+    bfi_check<std::uint16_t>(multiply, "65535 * 3", {65535, 3}, {65533});
+
+    // Temporary cell is only cleared, if the loop runs.
+    bfi_check(">>>+<<<[>>>[-]<<<-]>>>.", "Skipped loop", {}, {1});
+
+    // Same results with saturating cells, which keep the loops.
+    using saturating = bf::interpreter<std::uint8_t, bf::vector_tape<std::uint8_t>, bf::no_profiler,
+                                       bf::overflow::saturate>;
+    saturating test(multiply);
+    test.send_input({7, 9});
+    BOOST_CHECK(test.run() == bf::run_status::halted);
+    BOOST_CHECK(test.recv_output() == std::vector<std::uint8_t>({63}));
+}
+
+// ----- Interpreter: Cell types ----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_cell_types) {
+    // Counting above 255 without wrapping
+    bfi_check<std::uint16_t>("+++++[>++++++++++++++++++++<-]>[>++++++<-]>.", "600", {}, {600});
+    bfi_check<std::uint32_t>(",[>+++<-]>.", "3 * 100000", {100000}, {300000});
+    bfi_check<std::uint8_t> ("+++++[>++++++++++++++++++++<-]>[>++++++<-]>.", "600 % 256", {}, {88});
+
+    using saturating = bf::interpreter<std::uint8_t, bf::vector_tape<std::uint8_t>, bf::no_profiler,
+                                       bf::overflow::saturate>;
+    saturating clamp(std::string(300, '+') + ".>-.>,[->+++<]>.>++[->---<]>.");
+    clamp.send_input({100});
+    BOOST_CHECK(clamp.run() == bf::run_status::halted);
+    BOOST_CHECK(clamp.recv_output() == std::vector<std::uint8_t>({255, 0, 255, 0}));
+
+    // A saturated cell never reaches 0 by incrementing.
+    saturating endless("+[+]");
+    bf::run_limits limits;
+    limits.iterations = 1000;
+    BOOST_CHECK(endless.run(limits) == bf::run_status::budget_exhausted);
+    BOOST_CHECK(endless.get_memory()[0] == 255);
+
+    using trapping = bf::interpreter<std::uint16_t, bf::vector_tape<std::uint16_t>, bf::no_profiler,
+                                     bf::overflow::trap>;
+    BOOST_CHECK_THROW(trapping("-").run(), std::runtime_error);
+    BOOST_CHECK_THROW(trapping("+[+]").run(), std::runtime_error);
+    trapping fits(",[->+++<]>.");
+    fits.send_input({20000});
+    BOOST_CHECK(fits.run() == bf::run_status::halted);
+    BOOST_CHECK(fits.recv_output() == std::vector<std::uint16_t>({60000}));
+    trapping overflows(",[->++++<]>.");
+    overflows.send_input({20000});
+    BOOST_CHECK_THROW(overflows.run(), std::runtime_error);
+
+    // Programs are prepared for specific cells.
+    const auto prepared = std::make_shared<const bf::prepared_program>("+");
+    BOOST_CHECK_THROW(trapping{prepared}, std::logic_error);
+    BOOST_CHECK(!trapping::supports(bf::engine::jit));
+}
+
+// ----- Interpreter: Tape bounds ----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_tape_bounds) {
+    // Moving the stack pointer below cell 0 fails.
+    bf::interpreter<> test(">+[-<+>]<<.");
+    BOOST_CHECK_THROW(test.run(), std::runtime_error);
+    BOOST_CHECK(test.get_memory().size() >= 2 && test.get_memory().at(0) == 1);
+
+    bf::interpreter<unsigned char, bf::paged_tape<unsigned char>> paged(">+[-<+>]<<.");
+    BOOST_CHECK_THROW(paged.run(), std::runtime_error);
+    BOOST_CHECK(paged.get_memory().size() >= 2 && paged.get_memory().at(0) == 1);
+
+    // Cells below zero, which are only reached by an offset, are padding.
+    // Only bounds checks catch any access to them, however moves were folded.
+    using checked_vector = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::no_profiler,
+                                           bf::overflow::wrap, bf::all_checks>;
+    using checked_paged = bf::interpreter<unsigned char, bf::paged_tape<unsigned char>, bf::no_profiler,
+                                          bf::overflow::wrap, bf::all_checks>;
+    BOOST_CHECK(bf::interpreter<>("<+>+").run() == bf::run_status::halted);
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded}) {
+        for (const std::string program : {"<+>+", "<[-]>+", ">+[-<+>]<<.", "+[<<+>>-]"}) {
+            checked_vector vector_checked(program, engine);
+            BOOST_CHECK_THROW(vector_checked.run(), std::runtime_error);
+            BOOST_CHECK(vector_checked.recv_output().empty());
+            BOOST_CHECK_THROW(checked_paged(program, engine).run(), std::runtime_error);
+        }
+        // Folded loops which would not run do not access any cell.
+        BOOST_CHECK(checked_vector("[<<+>>-]+", engine).run() == bf::run_status::halted);
+    }
+
+    // Padding for offsets is not part of the memory.
+    const std::vector<unsigned char> reached = {0, 2};
+    bf::interpreter<> vector_memory("++[>+<-]>");
+    vector_memory.run();
+    BOOST_CHECK(vector_memory.get_memory() == reached);
+    bf::interpreter<unsigned char, bf::paged_tape<unsigned char>> paged_memory("++[>+<-]>");
+    paged_memory.run();
+    BOOST_CHECK(paged_memory.get_memory() == reached);
+#ifndef _WIN32
+    bf::interpreter<unsigned char, bf::guarded_tape<unsigned char>> guarded_memory("++[>+<-]>");
+    guarded_memory.run();
+    BOOST_CHECK(guarded_memory.get_memory() == reached);
+#endif
+
+#ifndef _WIN32
+    bf::interpreter<unsigned char, bf::guarded_tape<unsigned char>> guarded("+<+");
+    BOOST_CHECK_THROW(guarded.run(), std::runtime_error);
+    BOOST_CHECK(guarded.get_memory().at(0) == 1);
+
+    // The fault handler has to keep working after the first fault.
+    bf::interpreter<unsigned char, bf::guarded_tape<unsigned char>> again("+[<+]");
+    BOOST_CHECK_THROW(again.run(), std::runtime_error);
+
+    // After a fault, the tape is the one of the partial run. The interpreter
+    // cannot run again until a state is restored.
+    bf::interpreter<unsigned char, bf::guarded_tape<unsigned char>> resumed(">>,<<<<+");
+    BOOST_CHECK(resumed.run() == bf::run_status::needs_input);
+    const std::vector<char> state = resumed.save_state();
+    resumed.send_input({1});
+    BOOST_CHECK_THROW(resumed.run(), std::runtime_error);
+    BOOST_CHECK(resumed.get_memory().at(2) == 1);
+    BOOST_CHECK_THROW(resumed.run(), std::logic_error);
+    resumed.restore_state(state);
+    const std::vector<unsigned char> &restored = resumed.get_memory();
+    BOOST_CHECK(std::count(restored.begin(), restored.end(), 0) == static_cast<std::ptrdiff_t>(restored.size()));
+    BOOST_CHECK(resumed.run() == bf::run_status::needs_input);
+
+    // Moves which could skip the guard pages are rejected.
+    using guarded_type = bf::interpreter<unsigned char, bf::guarded_tape<unsigned char>>;
+    const std::string far = "+" + std::string(bf::guarded_tape<unsigned char>::guard_size, '>') + "+";
+    BOOST_CHECK_THROW(guarded_type{far}, std::logic_error);
+#endif
+}
+
+// ----- Interpreter: Paged tape -----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_paged_tape) {
+    // Only the pages of cell 0 and cell 10,000,000 are allocated
+    bf::interpreter<unsigned char, bf::paged_tape<unsigned char>> test("+" + std::string(10000000, '>') + ",[-<+>]<.");
+    test.send_input({5});
+    BOOST_CHECK(test.run() == bf::run_status::halted);
+    BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({5}));
+    BOOST_CHECK(test.get_stack_pointer() == 9999999);
+    BOOST_CHECK(test.get_tape().pages() == 2);
+
+    // Pages are cached per access, so alternating pages keep working.
+    bf::interpreter<unsigned short, bf::paged_tape<unsigned short, 2>> small(",[>>>>>+<<<<<-]>>>>>.");
+    small.send_input({1000});
+    small.run();
+    BOOST_CHECK(small.recv_output() == std::vector<unsigned short>({1000}));
+    BOOST_CHECK(small.get_tape().pages() == 2);
+    BOOST_CHECK(!decltype(small)::supports(bf::engine::jit));
+}
+
+// ----- Interpreter: Resumable execution --------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_resumable) {
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<>::supports(engine))
+            continue;
+        // Sum up input until the first 0, fed one cell at a time
+        bf::interpreter<> test(">,[[-<+>],]<.", engine);
+        for (const unsigned char input : {5, 10, 20}) {
+            BOOST_CHECK(test.run() == bf::run_status::needs_input);
+            BOOST_CHECK(test.recv_output().empty());
+            test.send_input({input});
+        }
+        BOOST_CHECK(test.run() == bf::run_status::needs_input);
+        test.send_input({0});
+        BOOST_CHECK(test.run() == bf::run_status::halted);
+        BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({35}));
+        BOOST_CHECK(test.run() == bf::run_status::halted);
+
+        // An input source without data suspends execution, too.
+        bool available = false;
+        bf::interpreter<> source(",.", engine);
+        source.set_input(std::unique_ptr<bf::input_source<unsigned char>>(new bf::callback_source<unsigned char>(
+            [&](unsigned char *buffer, std::size_t) -> std::size_t {
+                if (!available)
+                    return 0;
+                buffer[0] = 42;
+                return 1;
+            })));
+        BOOST_CHECK(source.run() == bf::run_status::needs_input);
+        available = true;
+        BOOST_CHECK(source.run() == bf::run_status::halted);
+        BOOST_CHECK(source.recv_output() == std::vector<unsigned char>({42}));
+    }
+}
+
+// ----- Interpreter: Limits ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_limits) {
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<>::supports(engine))
+            continue;
+        // 10 iterations, 9 back-edges
+        bf::interpreter<> test("++++++++++[>+.<-]", engine);
+        bf::run_limits limits;
+        limits.iterations = 4;
+        BOOST_CHECK(test.run(limits) == bf::run_status::budget_exhausted);
+        BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({1, 2, 3, 4, 5}));
+        BOOST_CHECK(test.run(limits) == bf::run_status::halted);
+        BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({6, 7, 8, 9, 10}));
+
+        limits.iterations = 0;
+        bf::interpreter<> none("+[]", engine);
+        BOOST_CHECK(none.run(limits) == bf::run_status::budget_exhausted);
+
+        // Endless loop with deadline
+        bf::interpreter<> endless("+[>+<]", engine);
+        bf::run_limits deadline;
+        deadline.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+        BOOST_CHECK(endless.run(deadline) == bf::run_status::budget_exhausted);
+        BOOST_CHECK(std::chrono::steady_clock::now() >= deadline.deadline);
+        deadline.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+        BOOST_CHECK(endless.run(deadline) == bf::run_status::budget_exhausted);
+    }
+}
+
+// ----- Interpreter: State snapshots ------------------------------------------
+template <typename memory_type, typename tape_type>
+void snapshot_check() {
+    // Prologue writes a banner and sets up a few cells, then adds input to them.
+    const std::string program = "++++++++[>++++++++<-]>+.>+++>>>>++<<<<<<,[>+>+<<-]>.>.";
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<memory_type, tape_type>::supports(engine))
+            continue;
+        bf::interpreter<memory_type, tape_type> prologue(program, engine);
+        BOOST_REQUIRE(prologue.run() == bf::run_status::needs_input);
+        const std::vector<char> state = prologue.save_state();
+
+        for (const memory_type input : {1, 2, 3}) {
+            bf::interpreter<memory_type, tape_type> fork(program, engine);
+            fork.restore_state(state);
+            fork.send_input({input});
+            BOOST_CHECK(fork.run() == bf::run_status::halted);
+            BOOST_CHECK(fork.recv_output() == std::vector<memory_type>({65, memory_type(65 + input), memory_type(3 + input)}));
+            BOOST_CHECK(fork.get_memory().at(6) == 2);
+        }
+
+        // Restoring resets everything else
+        bf::interpreter<memory_type, tape_type> used(program, engine);
+        used.send_input({7, 8});
+        used.run();
+        used.restore_state(state);
+        used.send_input({1});
+        used.run();
+        BOOST_CHECK(used.recv_output() == std::vector<memory_type>({65, 66, 4}));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_snapshots) {
+    snapshot_check<unsigned char, bf::vector_tape<unsigned char>>();
+    snapshot_check<unsigned short, bf::vector_tape<unsigned short>>();
+    snapshot_check<unsigned char, bf::paged_tape<unsigned char, 2>>();
+#ifndef _WIN32
+    snapshot_check<unsigned char, bf::guarded_tape<unsigned char>>();
+#endif
+
+    bf::interpreter<> test("+.,");
+    test.run();
+    std::vector<char> state = test.save_state();
+    BOOST_CHECK_THROW(bf::interpreter<>("-.,").restore_state(state), std::logic_error);
+    BOOST_CHECK_THROW(bf::interpreter<unsigned short>("+.,").restore_state(state), std::logic_error);
+    state.pop_back();
+    BOOST_CHECK_THROW(bf::interpreter<>("+.,").restore_state(state), std::runtime_error);
+
+    // Stack pointers beyond the tape (stored behind magic, size, hash and ip)
+    state = test.save_state();
+    const std::uint64_t far = std::numeric_limits<std::uint64_t>::max();
+    std::memcpy(state.data() + 28, &far, sizeof(far));
+    BOOST_CHECK_THROW(bf::interpreter<>("+.,").restore_state(state), std::runtime_error);
+#ifndef _WIN32
+    bf::interpreter<unsigned char, bf::guarded_tape<unsigned char>> guarded("+.,");
+    guarded.run();
+    state = guarded.save_state();
+    const std::uint64_t beyond = bf::guarded_tape<unsigned char>::default_size;
+    std::memcpy(state.data() + 28, &beyond, sizeof(beyond));
+    BOOST_CHECK_THROW(guarded.restore_state(state), std::runtime_error);
+#endif
+}
+
+// ----- Interpreter: Saved programs -------------------------------------------
+#ifndef _WIN32
+// Fixture: A new temporary directory, which is removed with its files.
+struct temporary_directory {
+    std::string path;
+
+    temporary_directory() {
+        std::string name = std::string(P_tmpdir) + "/bf_test_XXXXXX";
+        BOOST_REQUIRE(mkdtemp(&name[0]) != nullptr);
+        path = name;
+    }
+
+    ~temporary_directory() {
+        for (const std::string &file : files())
+            std::remove(file.c_str());
+        rmdir(path.c_str());
+    }
+
+    // Paths of all files in the directory
+    std::vector<std::string> files() const {
+        std::vector<std::string> result;
+        if (DIR *directory = opendir(path.c_str())) {
+            while (const dirent *entry = readdir(directory)) {
+                if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0)
+                    result.push_back(path + '/' + entry->d_name);
+            }
+            closedir(directory);
+        }
+        return result;
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(interpreter_saved_programs, temporary_directory) {
+    const std::string file = path + "/program.bfbc";
+    const std::string program = "++++++++[>++++++++<-]>+.,[>+>++<<-]>[[>]+[<]>-]>>[>]<[.<]>>.";
+    bf::interpreter<> reference(program);
+    reference.send_input({5});
+    reference.run();
+    const std::vector<unsigned char> expected_output = reference.recv_output();
+
+    for (const bool partial_evaluation : {false, true}) {
+        const bf::prepared_program original(program, bf::cell_type(), partial_evaluation);
+        original.save(file);
+
+        const auto loaded = bf::prepared_program::load(file);
+        BOOST_CHECK(loaded->source() == program && loaded->cells() == original.cells());
+        BOOST_CHECK(loaded->partial_evaluation() == partial_evaluation);
+        BOOST_CHECK(loaded->hash() == original.hash() && loaded->code().size() == original.code().size());
+        BOOST_CHECK(loaded->min_offset() == original.min_offset() && loaded->max_offset() == original.max_offset());
+        BOOST_CHECK(std::equal(loaded->positions().begin(), loaded->positions().end(), original.positions().begin()));
+        for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+            if (!bf::interpreter<>::supports(engine))
+                continue;
+            bf::interpreter<> test(loaded, engine);
+            test.send_input({5});
+            BOOST_CHECK(test.run() == bf::run_status::halted);
+            BOOST_CHECK(test.recv_output() == expected_output);
+        }
+    }
+
+    // Damaged files are rejected
+    bf::prepared_program("+[->+<]").save(file);
+    std::string contents;
+    {
+        std::ifstream in(file, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    const auto write = [&file](const std::string &data) {
+        std::ofstream(file, std::ios::binary) << data;
+    };
+    write(contents.substr(0, contents.size() - 1));
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+    std::string damaged = contents;
+    damaged[damaged.size() - 20] ^= 1; // Inside the last instruction
+    write(damaged);
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+    damaged = contents;
+    damaged[40] ^= 1; // Lowest offset in the header
+    write(damaged);
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+    damaged = contents;
+    damaged[damaged.size() - 1] = '\x7f'; // Position of the last instruction beyond the source
+    write(damaged);
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+    BOOST_CHECK_THROW(bf::prepared_program::load(path + "/missing.bfbc"), std::runtime_error);
+
+    // Bytecode changed by 'change', with a matching hash (header of 48 bytes
+    // and source padded to 8 bytes in front of the bytecode)
+    const auto rewrite = [&file, &write](const std::string &program, std::size_t size,
+                                  const std::function<void(bf::bytecode&)> &change) {
+        bf::prepared_program(program).save(file);
+        std::string data;
+        {
+            std::ifstream in(file, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(in), {});
+        }
+        bf::bytecode code(size);
+        BOOST_REQUIRE(program.size() <= 8 && data.size() == 56 + code.size() * (sizeof(bf::operation) + 4));
+        std::memcpy(code.data(), &data[56], code.size() * sizeof(bf::operation));
+        change(code);
+        const std::uint64_t hash = bf::hash(code);
+        std::memcpy(&data[56], code.data(), code.size() * sizeof(bf::operation));
+        std::memcpy(&data[32], &hash, sizeof(hash));
+        write(data);
+    };
+    // A scan without stride
+    rewrite("+[>]", 2, [](bf::bytecode &code) {
+        BOOST_REQUIRE(code[1].op == bf::opcode::scan);
+        code[1].value = 0;
+    });
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+    // Jumps which do not pair up the ends of a loop
+    rewrite("+[.-]", 5, [](bf::bytecode &code) {
+        BOOST_REQUIRE(code[1].op == bf::opcode::jump_zero);
+        code[1].target = 0;
+    });
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+    rewrite("+[.-]", 5, [](bf::bytecode &code) {
+        BOOST_REQUIRE(code[4].op == bf::opcode::jump_not_zero);
+        code[4].target = 4;
+    });
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+    rewrite("+[.-]", 5, [](bf::bytecode &code) {
+        code[4].op = bf::opcode::jump_zero;
+    });
+    BOOST_CHECK_THROW(bf::prepared_program::load(file), std::runtime_error);
+
+    // The cache prepares a program once and loads it afterwards.
+    const temporary_directory cache;
+    const auto first = bf::prepared_program::cached(cache.path, program);
+    BOOST_CHECK_EQUAL(cache.files().size(), 1);
+    const auto second = bf::prepared_program::cached(cache.path, program);
+    BOOST_CHECK_EQUAL(cache.files().size(), 1);
+    BOOST_CHECK(second->hash() == first->hash() && second->source() == program);
+    const auto other = bf::prepared_program::cached(cache.path, program, bf::cell_type(), true);
+    BOOST_CHECK(other->partial_evaluation() && other->hash() != first->hash());
+    BOOST_CHECK_EQUAL(cache.files().size(), 2);
+    // Damaged cache files are replaced.
+    for (const std::string &cached : cache.files())
+        std::ofstream(cached) << "damaged\n";
+    const auto third = bf::prepared_program::cached(cache.path, program);
+    BOOST_CHECK(third->hash() == first->hash());
+    BOOST_CHECK(bf::prepared_program::cached(cache.path, program)->hash() == first->hash());
+}
+#endif
+
+// ----- Interpreter: Batch runs -----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_batch) {
+    // Multiply two inputs
+    const auto program = std::make_shared<const bf::prepared_program>(",>,<[>[>+>+<<-]>>[<<+>>-]<<<-]>>.");
+    std::vector<std::vector<unsigned char>> inputs;
+    for (int i = 0; i < 1000; ++i)
+        inputs.push_back({static_cast<unsigned char>(i % 16), static_cast<unsigned char>(i % 13)});
+    inputs[500] = {1}; // Missing input
+
+    bf::thread_pool pool(4);
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<>::supports(engine))
+            continue;
+        const auto results = bf::run_batch(pool, program, inputs, engine);
+        BOOST_REQUIRE(results.size() == inputs.size());
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            if (i == 500)
+                continue;
+            BOOST_CHECK(results[i].status == bf::run_status::halted && !results[i].error);
+            BOOST_CHECK(results[i].output == std::vector<unsigned char>({
+                static_cast<unsigned char>(inputs[i][0] * inputs[i][1])}));
+        }
+        BOOST_CHECK(results[500].status == bf::run_status::needs_input);
+    }
+
+    // Errors are reported per input
+    const auto failing = bf::run_batch(pool, std::make_shared<const bf::prepared_program>(",[<]"),
+                                       std::vector<std::vector<unsigned char>>({{0}, {1}}));
+    BOOST_CHECK(!failing[0].error && failing[1].error);
+
+    // Exceptions of tasks are passed on after all tasks are done
+    std::atomic<int> done(0);
+    BOOST_CHECK_THROW(pool.parallel_for(100, [&done](std::size_t i) {
+        ++done;
+        if (i == 42)
+            throw std::runtime_error("Task failed!");
+    }), std::runtime_error);
+    BOOST_CHECK(done == 100);
+}
+
+// ----- Interpreter: Lockstep runs --------------------------------------------
+template <typename memory_type, std::size_t lanes>
+void lockstep_check(const std::string &program, const std::vector<std::vector<memory_type>> &inputs,
+                    const bf::run_limits &limits = bf::run_limits()) {
+    const auto prepared = std::make_shared<const bf::prepared_program>(program, bf::interpreter<memory_type>::cells());
+    bf::thread_pool pool(2);
+    const auto expected = bf::run_batch<memory_type>(pool, prepared, inputs, bf::engine::switch_dispatch, limits);
+    const auto results = bf::run_lockstep<memory_type, lanes>(prepared, inputs, bf::engine::switch_dispatch, limits);
+    BOOST_REQUIRE(results.size() == inputs.size());
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+        BOOST_CHECK_MESSAGE(results[i].status == expected[i].status && results[i].output == expected[i].output
+                            && !results[i].error == !expected[i].error,
+                            "Unexpected result of input " + std::to_string(i) + " for '" + program + "'!");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_lockstep) {
+    std::vector<std::vector<unsigned char>> inputs;
+    for (int i = 0; i < 37; ++i)
+        inputs.push_back({static_cast<unsigned char>(i % 16), static_cast<unsigned char>(i % 13)});
+    inputs[20] = {1}; // Missing input
+
+    // Same control flow for all inputs, folded loops only
+    lockstep_check<unsigned char, 16>(",>,<[>[>+>+<<-]>>[<<+>>-]<<<-]>>.", inputs);
+    // Loops diverge: Count down the first input, scan to different positions
+    lockstep_check<unsigned char, 16>(",[.-]>,.", inputs);
+    lockstep_check<unsigned char, 4>(",[>+>++<<-]>[[>]+[<]>-]>>[>]<[.<]>>.", inputs);
+    lockstep_check<unsigned short, 8>(",+[-[->+<]>.<]", std::vector<std::vector<unsigned short>>({{1000}, {1000}, {3}, {999}}));
+    // Errors and limits
+    lockstep_check<unsigned char, 16>(",[<]", inputs);
+    lockstep_check<unsigned char, 16>("<", inputs);
+    bf::run_limits limits;
+    limits.iterations = 6;
+    lockstep_check<unsigned char, 16>(",[->+<]+[.>,]", inputs, limits);
+    BOOST_CHECK_THROW(bf::run_lockstep(std::make_shared<const bf::prepared_program>("+", bf::cell_type::of<unsigned short>()),
+                                       inputs), std::logic_error);
+}
+
+// ----- Interpreter: JIT engine -----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_jit) {
+    BOOST_CHECK(!bf::interpreter<unsigned short>::supports(bf::engine::jit));
+#ifdef BF_JIT
+    // Resume after missing input
+    bf::interpreter<> test(",[->+<]>.<,.", bf::engine::jit);
+    BOOST_CHECK(test.run() == bf::run_status::needs_input);
+    test.send_input({3});
+    BOOST_CHECK(test.run() == bf::run_status::needs_input);
+    test.send_input({4});
+    BOOST_CHECK(test.run() == bf::run_status::halted);
+    BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({3, 4}));
+
+    // Growing tape
+    bf::interpreter<> grow("++++[>++++<-]>[[>]+[<]>-]>[>]<.", bf::engine::jit);
+    grow.run();
+    BOOST_CHECK(grow.recv_output() == std::vector<unsigned char>({1}));
+    BOOST_CHECK(grow.get_stack_pointer() == 17 && grow.get_memory().size() >= 18);
+
+    BOOST_CHECK_THROW(bf::interpreter<>("+<+", bf::engine::jit).run(), std::runtime_error);
+    bf::interpreter<unsigned char, bf::guarded_tape<unsigned char>> guarded(">>+[<+]", bf::engine::jit);
+    BOOST_CHECK_THROW(guarded.run(), std::runtime_error);
+#endif
+}
+
+// ----- Interpreter: Loop profiler --------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_loop_profiler) {
+    using profiled = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::loop_profiler>;
+    BOOST_CHECK(!profiled::supports(bf::engine::jit));
+
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded}) {
+        // Outer loop at position 2 runs twice, inner loop at position 7 three
+        // times per outer iteration.
+        profiled test("++[>+++[>+.<-]<-]", engine);
+        BOOST_CHECK(test.run() == bf::run_status::halted);
+        BOOST_CHECK(test.recv_output() == std::vector<unsigned char>({1, 2, 3, 4, 5, 6}));
+
+        const auto &profiler = test.get_profiler();
+        const auto loops = profiler.loops();
+        BOOST_REQUIRE_EQUAL(loops.size(), 2);
+        BOOST_CHECK_EQUAL(loops[0].source_position, 2);
+        BOOST_CHECK_EQUAL(loops[0].entries, 1);
+        BOOST_CHECK_EQUAL(loops[0].iterations, 2);
+        BOOST_CHECK_EQUAL(loops[1].source_position, 7);
+        BOOST_CHECK_EQUAL(loops[1].entries, 2);
+        BOOST_CHECK_EQUAL(loops[1].iterations, 6);
+        BOOST_CHECK(loops[0].instructions > loops[1].instructions);
+
+        std::uint64_t block_instructions = 0;
+        for (const auto &block : profiler.blocks())
+            block_instructions += block.instructions;
+        BOOST_CHECK_EQUAL(block_instructions, profiler.instructions());
+        BOOST_CHECK(profiler.report().find("[>+.<-]") != std::string::npos);
+    }
+}
+
+// ----- Interpreter: Policies -------------------------------------------------
+// Tape without padding for offsets, which grows on any access. Only cells up
+// to the highest stack pointer are accessible.
+class unpadded_tape {
+public:
+    static const bool contiguous = false;
+
+    unpadded_tape(std::int32_t, std::int32_t, std::int64_t) : m_cells(1), m_high(0) {}
+
+    unsigned char &operator[](std::size_t position) {
+        if (position >= m_cells.size())
+            m_cells.resize(position + 1);
+        return m_cells[position];
+    }
+
+    bool accessible(std::size_t position) const {return position <= m_high;}
+    void reserve(std::size_t position) {m_high = std::max(m_high, position);}
+    std::size_t capacity() const {return m_cells.max_size();}
+    const std::vector<unsigned char> &contents() const {return m_cells;}
+
+    void load(const unsigned char *cells, std::size_t count) {
+        m_cells.assign(cells, cells + count);
+        m_cells.resize(std::max<std::size_t>(count, 1));
+    }
+
+    template <typename function, typename fault_function>
+    auto guard(function &&f, fault_function&&) -> decltype(f()) {
+        return f();
+    }
+
+private:
+    std::vector<unsigned char> m_cells;
+    std::size_t                m_high;
+};
+
+BOOST_AUTO_TEST_CASE(interpreter_policies) {
+    using unchecked = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::no_profiler,
+                                      bf::overflow::wrap, bf::no_checks>;
+    using checked = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::no_profiler,
+                                    bf::overflow::wrap, bf::all_checks, bf::io_tracer>;
+    BOOST_CHECK(unchecked::supports(bf::engine::jit) == bf::interpreter<>::supports(bf::engine::jit));
+    BOOST_CHECK(!checked::supports(bf::engine::jit));
+
+    const std::string program = ",[>+>++<<-]>[[>]+[<]>-]>>[>]<[.<]>>.";
+    bf::interpreter<> reference(program);
+    reference.send_input({5});
+    reference.run();
+    const std::vector<unsigned char> expected_output = reference.recv_output();
+
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!unchecked::supports(engine))
+            continue;
+        unchecked test(program, engine);
+        test.send_input({5});
+        BOOST_CHECK(test.run() == bf::run_status::halted);
+        BOOST_CHECK(test.recv_output() == expected_output);
+
+        // Limits need the step budget.
+        bf::run_limits limits;
+        limits.iterations = 10;
+        BOOST_CHECK_THROW(unchecked(program, engine).run(limits), std::logic_error);
+    }
+
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded}) {
+        checked test(program, engine);
+        test.send_input({5});
+        BOOST_CHECK(test.run() == bf::run_status::halted);
+        BOOST_CHECK(test.recv_output() == expected_output);
+
+        bf::run_limits limits;
+        limits.iterations = 10;
+        checked limited(",[.-]", engine);
+        limited.send_input({50});
+        BOOST_CHECK(limited.run(limits) == bf::run_status::budget_exhausted);
+
+        // One read at position 0, writes at 30 and 35
+        const auto &events = test.get_tracer().events();
+        BOOST_REQUIRE_EQUAL(events.size(), expected_output.size() + 1);
+        BOOST_CHECK(!events[0].is_output && events[0].source_position == 0 && events[0].value == 5);
+        for (std::size_t e = 1; e < events.size(); ++e) {
+            BOOST_CHECK(events[e].is_output && events[e].value == expected_output[e - 1]);
+            BOOST_CHECK(events[e].source_position == (e + 1 < events.size() ? 30u : 35u));
+        }
+    }
+
+    // Writes folded by partial evaluation are traced, too.
+    checked folded(std::make_shared<const bf::prepared_program>("++.>+.", bf::cell_type(), true));
+    folded.run();
+    const auto &events = folded.get_tracer().events();
+    BOOST_REQUIRE_EQUAL(events.size(), 2);
+    BOOST_CHECK(events[0].is_output && events[0].value == 2);
+    BOOST_CHECK(events[1].is_output && events[1].value == 1);
+
+    // Cells out of reach of the stack pointer are only accessible by padding.
+    using unpadded = bf::interpreter<unsigned char, unpadded_tape>;
+    using unpadded_checked = bf::interpreter<unsigned char, unpadded_tape, bf::no_profiler,
+                                             bf::overflow::wrap, bf::all_checks>;
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded}) {
+        unpadded_checked offset("+>+<.", engine);
+        BOOST_CHECK_THROW(offset.run(), std::runtime_error);
+        BOOST_CHECK_EQUAL(offset.get_stack_pointer(), 0);
+        unpadded grows("+>+<.", engine);
+        BOOST_CHECK(grows.run() == bf::run_status::halted);
+        BOOST_CHECK(grows.recv_output() == std::vector<unsigned char>({1}));
+    }
+}
+
+// ----- Interpreter: Statistics -----------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_statistics) {
+    using counted = bf::interpreter<unsigned char, bf::vector_tape<unsigned char>, bf::step_counter>;
+    BOOST_CHECK(!counted::supports(bf::engine::jit));
+
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded}) {
+        // Read, loop entry, then three times write, add and back-edge
+        counted test(",[.-]>>", engine);
+        test.send_input({3});
+        BOOST_CHECK(test.run() == bf::run_status::halted);
+        const bf::run_statistics statistics = test.statistics();
+        BOOST_CHECK(statistics.counted);
+        BOOST_CHECK_EQUAL(statistics.instructions, 12);
+        BOOST_CHECK_EQUAL(statistics.commands, 13);
+        BOOST_CHECK_EQUAL(statistics.loop_repeats, 2);
+        BOOST_CHECK_EQUAL(statistics.opcodes[static_cast<std::size_t>(bf::opcode::write)], 3);
+        BOOST_CHECK_EQUAL(statistics.opcodes[static_cast<std::size_t>(bf::opcode::move)], 1);
+        BOOST_CHECK_EQUAL(statistics.max_cell, 2);
+        BOOST_CHECK_EQUAL(statistics.cells_read, 1);
+        BOOST_CHECK_EQUAL(statistics.cells_written, 3);
+
+        // Folded loops count once.
+        counted folded("++[->+<]", engine);
+        folded.run();
+        BOOST_CHECK_EQUAL(folded.statistics().commands, 8);
+        BOOST_CHECK_EQUAL(folded.statistics().loop_repeats, 0);
+        BOOST_CHECK(folded.statistics().instructions < 8);
+
+        // Counts accumulate over runs until the profiler is reset.
+        counted resumed(",.,.", engine);
+        resumed.send_input({1});
+        BOOST_CHECK(resumed.run() == bf::run_status::needs_input);
+        resumed.send_input({2});
+        resumed.run();
+        BOOST_CHECK_EQUAL(resumed.statistics().instructions, 5); // The read waiting for input twice
+        BOOST_CHECK_EQUAL(resumed.statistics().cells_written, 2);
+        resumed.get_profiler().reset();
+        BOOST_CHECK_EQUAL(resumed.statistics().instructions, 0);
+    }
+
+    // Without a counting profiler, only I/O and tape are counted.
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<>::supports(engine))
+            continue;
+        bf::interpreter<> test(",[.-]>>", engine);
+        test.send_input({3});
+        test.run();
+        const bf::run_statistics statistics = test.statistics();
+        BOOST_CHECK(!statistics.counted && statistics.instructions == 0);
+        BOOST_CHECK_EQUAL(statistics.max_cell, 2);
+        BOOST_CHECK_EQUAL(statistics.cells_read, 1);
+        BOOST_CHECK_EQUAL(statistics.cells_written, 3);
+    }
+
+    // Cells reached by offsets only count, too.
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<>::supports(engine))
+            continue;
+        bf::interpreter<> offsets("+>>>>>+<<<<<", engine);
+        offsets.run();
+        BOOST_CHECK_EQUAL(offsets.statistics().max_cell, 5);
+        BOOST_CHECK_EQUAL(offsets.get_memory().size(), 6);
+        bf::interpreter<> moved(">>>+[>+<-]<", engine);
+        moved.run();
+        BOOST_CHECK_EQUAL(moved.statistics().max_cell, 4);
+        BOOST_CHECK_EQUAL(moved.get_memory().size(), 5);
+    }
+
+    // The paged tape is not copied for it.
+    bf::interpreter<unsigned char, bf::paged_tape<unsigned char>> paged(">>>+" + std::string(10000, '>') + "<+");
+    paged.run();
+    const std::size_t pages = paged.get_tape().pages();
+    BOOST_CHECK_EQUAL(paged.statistics().max_cell, 10002);
+    BOOST_CHECK_EQUAL(paged.get_tape().pages(), pages);
+}
+
+// ----- Interpreter: Streaming I/O --------------------------------------------
+BOOST_AUTO_TEST_CASE(interpreter_streaming_io) {
+    // Copy input to output until the first 0
+    std::string data;
+    for (int i = 0; i < 100000; ++i)
+        data.push_back(static_cast<char>('a' + i % 26));
+
+    for (const auto engine : {bf::engine::switch_dispatch, bf::engine::threaded, bf::engine::jit}) {
+        if (!bf::interpreter<>::supports(engine))
+            continue;
+        std::istringstream in(data + '\0');
+        std::ostringstream out;
+        bf::interpreter<> test(",[.,]", engine);
+        test.set_input(std::unique_ptr<bf::input_source<unsigned char>>(new bf::stream_source<unsigned char>(in)));
+        test.set_output(std::unique_ptr<bf::output_sink<unsigned char>>(new bf::stream_sink<unsigned char>(out)));
+        test.run();
+        BOOST_CHECK(out.str() == data);
+        BOOST_CHECK(test.recv_output().empty());
+
+        // Output is passed on in chunks and before more input is requested.
+        std::size_t chunks = 0, largest = 0;
+        bf::interpreter<> prompt("+.,.", engine);
+        prompt.set_input(std::unique_ptr<bf::input_source<unsigned char>>(new bf::callback_source<unsigned char>(
+            [&](unsigned char *buffer, std::size_t size) -> std::size_t {
+                BOOST_CHECK(chunks == 1 && size > 0);
+                buffer[0] = 7;
+                return 1;
+            })));
+        prompt.set_output(std::unique_ptr<bf::output_sink<unsigned char>>(new bf::callback_sink<unsigned char>(
+            [&](const unsigned char*, std::size_t size) {
+                ++chunks;
+                largest = std::max(largest, size);
+            })));
+        prompt.run();
+        BOOST_CHECK(chunks == 2 && largest == 1);
+
+        // Exceptions of sinks are passed on.
+        bf::interpreter<> failing("+.", engine);
+        failing.set_output(std::unique_ptr<bf::output_sink<unsigned char>>(new bf::callback_sink<unsigned char>(
+            [](const unsigned char*, std::size_t) {throw std::runtime_error("Sink failed!");})));
+        BOOST_CHECK_THROW(failing.run(), std::runtime_error);
+    }
+
+#ifndef _WIN32
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+    BOOST_REQUIRE(write(fds[1], "\3\4", 2) == 2);
+    close(fds[1]);
+    bf::interpreter<> pipe_test(",>,[-<+>]<.");
+    pipe_test.set_input(std::unique_ptr<bf::input_source<unsigned char>>(new bf::fd_source<unsigned char>(fds[0])));
+    pipe_test.run();
+    close(fds[0]);
+    BOOST_CHECK(pipe_test.recv_output() == std::vector<unsigned char>({7}));
+#endif
+}
+
+// ----- C backend: Idioms -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(c_backend_idioms) {
+    const std::string c = bf::emit_c(",[>+++<-]>.[-]<[<]");
+    BOOST_CHECK(c.find("c[0] = read_cell();")  != std::string::npos);
+    BOOST_CHECK(c.find("c[1] += c[0] * 3;")    != std::string::npos);
+    BOOST_CHECK(c.find("c[0] = 0;")            != std::string::npos);
+    BOOST_CHECK(c.find("while (c[0]) { c += -1; RESERVE(); }") != std::string::npos);
+    BOOST_CHECK(c.find("while (c[0]) {\n")     == std::string::npos);
+    BOOST_CHECK_THROW(bf::emit_c("[["), std::logic_error);
+}
+
+// ----- C backend: Native executable ------------------------------------------
+#ifndef _WIN32
+// Whether "cc" is found in PATH
+static bool has_c_compiler() {
+    std::istringstream directories(std::getenv("PATH") ? std::getenv("PATH") : "");
+    for (std::string directory; std::getline(directories, directory, ':');) {
+        if (access((directory + "/cc").c_str(), X_OK) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Run 'executable' with standard input from file 'input' and standard output
+// to file 'output'. Returns its exit code, or -1 if it did not exit normally.
+static int run_native(const std::string &executable, const std::string &input, const std::string &output) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, input.c_str(), O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    char *const argv[] = {const_cast<char*>(executable.c_str()), nullptr};
+    pid_t pid;
+    const int error = posix_spawn(&pid, executable.c_str(), &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    int status;
+    if (error != 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+BOOST_FIXTURE_TEST_CASE(c_backend_native, temporary_directory,
+                        *boost::unit_test::precondition([](boost::unit_test::test_unit_id) {
+                            return has_c_compiler();
+                        })) {
+    const std::string executable = path + "/program";
+    const std::string input      = path + "/input";
+    const std::string output     = path + "/output";
+    const std::string program = ",[>+>++<<-]>[[>]+[<]>-]>>[>]<[.<]>>.";
+    bf::compile_c(bf::emit_c(program), executable);
+
+    std::ofstream(input, std::ios::binary) << '\005';
+    BOOST_REQUIRE_EQUAL(run_native(executable, input, output), 0);
+    std::ifstream in(output, std::ios::binary);
+    const std::vector<unsigned char> native_output(std::istreambuf_iterator<char>(in), {});
+
+    bf::interpreter<> reference(program);
+    reference.send_input({5});
+    reference.run();
+    BOOST_CHECK(native_output == reference.recv_output());
+    BOOST_CHECK(!native_output.empty());
+
+    // Errors are reported with exit code 1.
+    bf::compile_c(bf::emit_c("<"), executable);
+    BOOST_CHECK_EQUAL(run_native(executable, input, output), 1);
+}
+#endif